@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <windows.h>
 #include <conio.h>
 #include <math.h>
@@ -16,6 +17,9 @@
 #define MAX_FUEL 10000
 #define MAX_BANK_ANGLE 30
 #define MIN_BANK_ANGLE 0
+#define INTERCEPT_GAIN 10.0 // deg of intercept angle per nm off track
+#define MAX_INTERCEPT 30.0  // deg
+#define TURN_RATE 3.0       // deg/s, standard rate turn
 
 
 // Aircraft type definitions
@@ -47,7 +51,9 @@ struct Airport {
     int has_ils;         // 0 or 1
 };
 
-// Waypoint structure
+// Waypoint structure. A flight plan is an array of waypoints starting at the
+// departure; the leg fields describe the leg from the previous waypoint and
+// are precomputed once by loadFlightPlan().
 struct Waypoint {
     char name[20];
     float lat;
@@ -55,6 +61,10 @@ struct Waypoint {
     float altitude;      // ft
     float speed;        // knots
     int type;          // 0=airport, 1=fix, 2=vor, 3=ndb
+    float course;       // deg true, initial course of the leg
+    float course_sin, course_cos;
+    float length;       // nm
+    float remaining;    // nm of the legs after this one
 };
 
 // Enhanced FlightData structure
@@ -85,6 +95,9 @@ struct FlightData {
     int autopilot;       // 0=off, 1=on
     int transponder;     // 0=off, 1=on
     AircraftType type;   // Aircraft type
+    int leg;             // waypoint being flown to
+    float along_track;   // nm flown along the active leg
+    float cross_track;   // nm right of the active leg
 };
 
 // Aircraft performance parameters
@@ -125,20 +138,29 @@ struct Weather current_weather = {
     0        // precipitation
 };
 
+// Value being typed after T, B or F; entry_key is 0 when none is open
+char entry_key = 0;
+char entry_text[16] = "";
+int entry_length = 0;
+
 // Function declarations
 void initAircraftPerformance(AircraftType type, struct AircraftPerformance* perf);
 void calculateAerodynamics(struct FlightData* plane, struct AircraftPerformance* perf);
-void updateWeather(void);
+void updateWeather(const struct FlightData* plane);
 void calculateWindEffect(struct FlightData* plane);
 void updateNavigation(struct FlightData* plane, struct Waypoint* waypoints, int num_waypoints);
+void legOffset(const struct Waypoint* from, const struct Waypoint* to, float lat, float lon,
+               float* along, float* cross);
+int loadFlightPlan(struct Waypoint* waypoints, int dep_idx, const int* via, int via_count, int dest_idx);
 void checkFlightEnvelope(struct FlightData* plane, struct AircraftPerformance* perf);
 void updateInstruments(struct FlightData* plane);
 void logData(FILE* log, int time, struct FlightData plane, const char* dep, const char* dest);
 void displayFlightInfo(struct FlightData* plane, int time);
 void handleUserInput(struct FlightData* plane, struct AircraftPerformance* perf);
+const char* entryPrompt(char key);
 const char* getPhaseName(int phase);
 float calculateDistance(float lat1, float lon1, float lat2, float lon2);
-void initFlight(struct FlightData* plane, int dep_idx, int dest_idx);
+void initFlight(struct FlightData* plane, int dep_idx, float distance);
 void updateFlight(struct FlightData* plane);
 
 // Initialize aircraft performance based on type
@@ -206,11 +228,12 @@ void calculateAerodynamics(struct FlightData* plane, struct AircraftPerformance*
 }
 
 // Update weather conditions
-void updateWeather(void) {
+void updateWeather(const struct FlightData* plane) {
     // Simple random weather changes
     current_weather.wind_speed += (rand() % 3 - 1) * 0.5;
     current_weather.wind_direction += (rand() % 3 - 1) * 5.0;
-    current_weather.temperature -= 0.0065 * 100; // Temperature lapse rate
+    // Standard lapse rate from the surface temperature, constant above the tropopause
+    current_weather.temperature = plane->temperature - 0.0065 * fmin(plane->altitude, 36089) * 0.3048;
     current_weather.pressure = 1013.25 * pow((288.15 - 0.0065 * 100) / 288.15, 5.256);
 }
 
@@ -235,7 +258,6 @@ void calculateWindEffect(struct FlightData* plane) {
 void updateNavigation(struct FlightData* plane, struct Waypoint* waypoints, int num_waypoints) {
     // Basic navigation update
     float lat_rad = plane->lat * PI / 180.0;
-    float lon_rad = plane->lon * PI / 180.0;
     
     // Update position based on ground speed and heading
     float distance_nm = plane->ground_speed / 3600.0;
@@ -243,6 +265,63 @@ void updateNavigation(struct FlightData* plane, struct Waypoint* waypoints, int
     
     plane->lat += (distance_nm * cos(heading_rad)) / 60.0;
     plane->lon += (distance_nm * sin(heading_rad)) / (60.0 * cos(lat_rad));
+    if (num_waypoints < 2) return;
+
+    // Track the active leg from this tick's displacement, no trigonometry
+    // toward the destination
+    const struct Waypoint* to = &waypoints[plane->leg];
+    plane->along_track += distance_nm * (cos(heading_rad) * to->course_cos + sin(heading_rad) * to->course_sin);
+    plane->cross_track += distance_nm * (sin(heading_rad) * to->course_cos - cos(heading_rad) * to->course_sin);
+    while (plane->along_track >= to->length && plane->leg < num_waypoints - 1) {
+        to = &waypoints[++plane->leg];
+        legOffset(&waypoints[plane->leg - 1], to, plane->lat, plane->lon, &plane->along_track, &plane->cross_track);
+    }
+    plane->distance_remaining = to->remaining + to->length - plane->along_track;
+    if (plane->phase < 2) return; // steer once airborne
+
+    // Intercept angle proportional to the cross-track error, standard rate turn
+    float intercept = fmax(fmin(plane->cross_track * INTERCEPT_GAIN, MAX_INTERCEPT), -MAX_INTERCEPT);
+    float turn = fmod(to->course - intercept - plane->heading, 360.0);
+    if (turn > 180) turn -= 360;
+    else if (turn < -180) turn += 360;
+    turn = fmax(fmin(turn, TURN_RATE), -TURN_RATE);
+    plane->heading = fmod(plane->heading + turn + 360.0, 360.0);
+}
+
+// Along- and cross-track position on the leg from one waypoint to the next,
+// from a flat projection at the leg start. Used once when a leg becomes active.
+void legOffset(const struct Waypoint* from, const struct Waypoint* to, float lat, float lon,
+               float* along, float* cross) {
+    float north = (lat - from->lat) * 60;
+    float east = (lon - from->lon) * 60 * cos((lat + from->lat) / 2 * PI / 180.0);
+    *along = north * to->course_cos + east * to->course_sin;
+    *cross = east * to->course_cos - north * to->course_sin;
+}
+
+// Fill a flight plan: departure, via airports and destination, with each
+// leg's initial course and length computed once. Returns the waypoint count.
+int loadFlightPlan(struct Waypoint* waypoints, int dep_idx, const int* via, int via_count, int dest_idx) {
+    int count = 0;
+    for (int i = -1; i <= via_count; i++) {
+        const struct Airport* airport = &airports[i < 0 ? dep_idx : i < via_count ? via[i] : dest_idx];
+        struct Waypoint* wp = &waypoints[count++];
+        memset(wp, 0, sizeof(*wp));
+        strcpy(wp->name, airport->code);
+        wp->lat = airport->lat;
+        wp->lon = airport->lon;
+        wp->altitude = airport->elevation;
+        if (count == 1) continue;
+        const struct Waypoint* from = wp - 1;
+        float lat1 = from->lat * PI / 180.0, lat2 = wp->lat * PI / 180.0;
+        float dlon = (wp->lon - from->lon) * PI / 180.0;
+        wp->course = fmod(atan2(sin(dlon) * cos(lat2), cos(lat1) * sin(lat2) - sin(lat1) * cos(lat2) * cos(dlon))
+                          * 180.0 / PI + 360.0, 360.0);
+        wp->course_sin = sin(wp->course * PI / 180.0);
+        wp->course_cos = cos(wp->course * PI / 180.0);
+        wp->length = calculateDistance(from->lat, from->lon, wp->lat, wp->lon);
+    }
+    for (int i = count - 2; i >= 1; i--) waypoints[i].remaining = waypoints[i + 1].remaining + waypoints[i + 1].length;
+    return count;
 }
 
 // Check flight envelope
@@ -311,28 +390,64 @@ void displayFlightInfo(struct FlightData* plane, int time) {
     printf("A - Autopilot\n");
     printf("X - Transponder\n");
     printf("Q - Quit\n");
+    if (entry_key) printf("\n%s%s", entryPrompt(entry_key), entry_text);
+}
+
+// Prompt for a control value typed after its key
+const char* entryPrompt(char key) {
+    switch (key) {
+        case 't': return "Enter throttle (0-1): ";
+        case 'b': return "Enter bank angle (0-30 deg): ";
+        default: return "Enter flaps (0-40 deg): ";
+    }
 }
 
-// Handle user input
+// Handle user input without blocking: keys are read as they arrive and a
+// typed value is applied at the start of the tick after Enter, so the
+// flight keeps running while the pilot types. Escape drops the value.
 void handleUserInput(struct FlightData* plane, struct AircraftPerformance* perf) {
-    if (_kbhit()) {
+    while (_kbhit()) {
         char input = _getch();
+        if (entry_key) {
+            if (input == '\r') {
+                char* end;
+                float value = strtof(entry_text, &end);
+                if (end != entry_text) {
+                    switch (entry_key) {
+                        case 't':
+                            plane->throttle = value >= 0 && value <= 1 ? value : 0.8;
+                            break;
+                        case 'b':
+                            plane->bank_angle = value >= MIN_BANK_ANGLE && value <= MAX_BANK_ANGLE ? value : 15;
+                            break;
+                        case 'f':
+                            plane->flaps = (int)value >= 0 && (int)value <= 40 ? (int)value : 0;
+                            break;
+                    }
+                }
+                entry_key = 0;
+            } else if (input == 27) {
+                entry_key = 0;
+            } else if (input == '\b') {
+                if (entry_length > 0) {
+                    entry_text[--entry_length] = '\0';
+                    printf("\b \b");
+                }
+            } else if (input && strchr("0123456789.-", input) && entry_length < (int)sizeof(entry_text) - 1) {
+                entry_text[entry_length++] = input;
+                entry_text[entry_length] = '\0';
+                putchar(input);
+            }
+            continue;
+        }
         switch (input) {
             case 't':
-                printf("\nEnter throttle (0-1): ");
-                scanf("%f", &plane->throttle);
-                if (plane->throttle < 0 || plane->throttle > 1) plane->throttle = 0.8;
-                break;
             case 'b':
-                printf("\nEnter bank angle (0-30 deg): ");
-                scanf("%f", &plane->bank_angle);
-                if (plane->bank_angle < MIN_BANK_ANGLE || plane->bank_angle > MAX_BANK_ANGLE) 
-                    plane->bank_angle = 15;
-                break;
             case 'f':
-                printf("\nEnter flaps (0-40 deg): ");
-                scanf("%d", &plane->flaps);
-                if (plane->flaps < 0 || plane->flaps > 40) plane->flaps = 0;
+                entry_key = input;
+                entry_text[0] = '\0';
+                entry_length = 0;
+                printf("\n%s", entryPrompt(entry_key));
                 break;
             case 'g':
                 plane->gear = !plane->gear;
@@ -347,6 +462,7 @@ void handleUserInput(struct FlightData* plane, struct AircraftPerformance* perf)
                 return;
         }
     }
+    fflush(stdout); // echo typed characters before the next refresh
 }
 
 const char* getPhaseName(int phase) {
@@ -370,9 +486,8 @@ float calculateDistance(float lat1, float lon1, float lat2, float lon2) {
     return 3440.0 * c;
 }
 
-void initFlight(struct FlightData* plane, int dep_idx, int dest_idx) {
-    float distance = calculateDistance(airports[dep_idx].lat, airports[dep_idx].lon,
-                                     airports[dest_idx].lat, airports[dest_idx].lon);
+// Put the aircraft on the departure runway for a route of the given length
+void initFlight(struct FlightData* plane, int dep_idx, float distance) {
     plane->distance_remaining = distance;
     plane->altitude = airports[dep_idx].elevation;
     plane->prev_altitude = plane->altitude;
@@ -391,6 +506,9 @@ void initFlight(struct FlightData* plane, int dep_idx, int dest_idx) {
     plane->transponder = 1;
     plane->temperature = current_weather.temperature;
     plane->pressure = current_weather.pressure;
+    plane->leg = 1;
+    plane->along_track = 0;
+    plane->cross_track = 0;
 }
 
 void updateFlight(struct FlightData* plane) {
@@ -415,7 +533,6 @@ void updateFlight(struct FlightData* plane) {
             plane->speed += plane->throttle * 2.0 - 0.5;
             plane->altitude += plane->speed * 0.5; // 500 ft/s climb rate
             plane->fuel -= plane->throttle * 0.2;
-            plane->distance_remaining -= plane->speed / 3600.0;
             if (plane->altitude >= 30000) {
                 plane->phase = 3; // Cruise
                 plane->flaps = 0; // Retract flaps
@@ -426,7 +543,6 @@ void updateFlight(struct FlightData* plane) {
             plane->speed += (plane->throttle * 400 - plane->speed) * 0.05;
             plane->altitude += (30000 - plane->altitude) * 0.1;
             plane->fuel -= plane->throttle * 0.15;
-            plane->distance_remaining -= plane->speed / 3600.0;
             if (plane->distance_remaining < 100) {
                 plane->phase = 4; // Descent
                 plane->flaps = 10; // Deploy initial flaps
@@ -437,7 +553,6 @@ void updateFlight(struct FlightData* plane) {
             plane->speed += (plane->throttle * 300 - plane->speed) * 0.05;
             plane->altitude -= plane->speed * 0.4; // 400 ft/s descent
             plane->fuel -= plane->throttle * 0.1;
-            plane->distance_remaining -= plane->speed / 3600.0;
             if (plane->altitude <= 5000) {
                 plane->phase = 5; // Approach
                 plane->flaps = 20; // Deploy more flaps
@@ -449,7 +564,6 @@ void updateFlight(struct FlightData* plane) {
             plane->speed -= 5.0;
             plane->altitude -= plane->speed * 0.2;
             plane->fuel -= plane->throttle * 0.05;
-            plane->distance_remaining -= plane->speed / 3600.0;
             if (plane->altitude <= 0) {
                 plane->altitude = 0; // Landed
                 plane->flaps = 0; // Retract flaps
@@ -478,7 +592,8 @@ void logData(FILE* log, int time, struct FlightData plane, const char* dep, cons
 int main() {
     struct FlightData plane = {0};
     struct AircraftPerformance perf;
-    int flight_time = 0, dep_idx, dest_idx;
+    struct Waypoint waypoints[MAX_WAYPOINTS];
+    int flight_time = 0, dep_idx, dest_idx, via[MAX_WAYPOINTS - 2], via_count = 0;
     FILE* log = fopen("flight_log.txt", "w");
     if (!log) {
         printf("ERROR: Could not open flight_log.txt!\n");
@@ -507,9 +622,18 @@ int main() {
         scanf("%d", &dest_idx);
     } while (dest_idx == dep_idx);
 
+    printf("\nVia airports (0-%d), -1 when done:\n", MAX_AIRPORTS - 1);
+    int fix;
+    while (via_count < MAX_WAYPOINTS - 2 && scanf("%d", &fix) == 1 && fix >= 0) {
+        if (fix < MAX_AIRPORTS) via[via_count++] = fix;
+    }
+
     // Initialize flight
-    initFlight(&plane, dep_idx, dest_idx);
-    printf("\nFlight Plan: %s to %s\n", airports[dep_idx].name, airports[dest_idx].name);
+    int num_waypoints = loadFlightPlan(waypoints, dep_idx, via, via_count, dest_idx);
+    initFlight(&plane, dep_idx, waypoints[1].remaining + waypoints[1].length);
+    printf("\nFlight Plan: %s", airports[dep_idx].name);
+    for (int i = 1; i < num_waypoints; i++) printf(" - %s", waypoints[i].name);
+    printf("\n");
     printf("Distance: %.0f nm | Fuel: %.0f gal\n", plane.distance_remaining, plane.fuel);
     printf("Ready on runway. Request takeoff? (y/n): ");
 
@@ -520,10 +644,10 @@ int main() {
         updateFlight(&plane);
         calculateAerodynamics(&plane, &perf);
         calculateWindEffect(&plane);
-        updateNavigation(&plane, NULL, 0);
+        updateNavigation(&plane, waypoints, num_waypoints);
         checkFlightEnvelope(&plane, &perf);
         updateInstruments(&plane);
-        updateWeather();
+        updateWeather(&plane);
         
         displayFlightInfo(&plane, flight_time);
         logData(log, flight_time, plane, airports[dep_idx].name, airports[dest_idx].name);
@@ -1,13 +1,50 @@
+#define _FILE_OFFSET_BITS 64
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <signal.h>
+#include <string.h>
 #include <time.h>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+typedef SOCKET TelemetrySocket;
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+typedef int TelemetrySocket;
+#define INVALID_SOCKET (-1)
+#define closesocket close
+#endif
+#if defined(APM_NO_SIMD)
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #define GRAVITY 32.174 // ft/s^2
 #define PI 3.14159
-#define MAX_AIRPORTS 10
+#define MAX_AIRPORTS 10       // built-in route network, always airports 0-9
 #define MAX_ALTITUDE 40000
 #define MIN_ALTITUDE 0
 #define MAX_SPEED 500
@@ -15,19 +52,274 @@
 #define MAX_FUEL 10000
 #define MAX_BANK_ANGLE 30
 #define MIN_BANK_ANGLE 0
+#define MAX_FLIGHT_TIME 86400 // s, headless safety cut-off
+#define MAX_TICK 3600        // s per tick
+#define MAX_SUBSTEPS 1000    // physics steps per tick
+#define FLEET_ALIGN 64       // bytes, column alignment
+#define FLEET_BLOCK 256      // aircraft stepped together per cache block
+#define FLEET_CHUNK 512      // aircraft per scheduler task, multiple of SIMD width
+#define MAX_WORKERS 64
+#define LOG_SCHEMA_VERSION 2
+#define LOG_BLOCK_TICKS 4096 // ticks per binary log block
+#define LOG_BYTE_ORDER 0x01020304 // read back in the writer's byte order
+#define LOG_NAME 64          // bytes per airport name in a binary log header
+#define LOG_RING_SIZE 4096   // async log ring slots, power of two
+#define LOG_WRITE_BATCH 512  // records per writer batch
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_DATAGRAM 8192      // bytes per telemetry datagram at most
+#define TELEMETRY_FRAMES ((int)((TELEMETRY_DATAGRAM - sizeof(struct TelemetryHeader)) / sizeof(struct LogRecord)))
+#define TELEMETRY_MAX_SUBSCRIBERS 16
+#define TELEMETRY_KEEPALIVE 1000     // ms between a subscriber's subscribe requests
+#define TELEMETRY_TIMEOUT 5000       // ms without one before a subscriber is dropped
+#define TELEMETRY_WAIT 30000         // ms --subscribers waits at most
+#define MAP_WINDOW (64 << 20) // bytes of a file mapped at once
+#define WEATHER_VERSION 1
+#define WEATHER_FIELDS 3     // wind toward east and north (kt), temperature (C)
+#define WEATHER_TILE 8       // grid cells per weather tile edge
+#define WEATHER_POINTS (WEATHER_TILE + 1) // grid points per tile edge
+#define WEATHER_ROW (WEATHER_FIELDS * WEATHER_POINTS)     // floats between tile rows
+#define WEATHER_LEVEL (WEATHER_ROW * WEATHER_POINTS)      // floats between tile levels
+#define WEATHER_MAX_LEVELS 64
+#define WEATHER_WAYS 16      // tile cache associativity, at least twice SIMD_LANES
+#define WEATHER_SETS 4
+#define WEATHER_INDEX 256    // tile cache index entries, a power of two
+#define ATLAS_WIDTH 512      // px, glyph atlas texture width
+#define ATLAS_GLYPHS 96      // printable ASCII plus the degree sign
+#define GLYPH_DEGREE 95      // atlas slot for U+00B0
+#define MAX_TEXT_GLYPHS 512  // glyph quads per draw call
+#define TEXT_CACHE_SIZE 32
+#define PANEL_INPUTS 4       // state values a cockpit panel is drawn from
+#define NUM_GAUGES 6
+#define MAX_GAUGE_TICKS 36   // one every 10 degrees
+#define NUM_PHASES 6
+#define STRING_BLOCK 65536   // bytes per interned string arena block
+#define GRID_ROWS 180        // 1 degree airport grid cells
+#define GRID_COLS 360
+#define MAX_CSV_FIELDS 15
+#define MAX_DIVERSIONS 32
+#define DIVERSION_BATCH 256  // candidates scored per batchDistance() call
+#define ILS_VISIBILITY 3.0   // nm, below this a diversion needs an ILS
+#define MAX_WAYPOINTS 20     // via fixes in a flight plan
+#define MAX_PLAN_LEGS 64
+#define LEG_MAX_LENGTH 250.0 // nm, longer great-circle legs are split to stay nearly straight
+#define INTERCEPT_GAIN 10.0  // deg of intercept angle per nm off track
+#define MAX_INTERCEPT 30.0   // deg
+#define TURN_RATE 3.0        // deg/s, standard rate turn
+#define ISA_STEP 250.0f      // ft between standard atmosphere table rows
+#define ISA_ROWS 290
+#define ISA_TROPOPAUSE 36089.24f // ft
+#define ISA_FLOOR (ISA_TROPOPAUSE - 153 * ISA_STEP) // ft, about -2160 so a row falls on the tropopause
+#define DESCENT_DISTANCE 100 // nm to go at top of descent
+#define SNAPSHOT_VERSION 1
+#define JOURNAL_VERSION 1
+#define BENCH_SCHEMA_VERSION 1
+#define BENCH_SEED 12345u
+#define BENCH_STATES 64      // flight states the benchmark fleet starts from
+#define BENCH_TICKS 64       // ticks timed between resets to the starting states
+#define BENCH_MAX_REPEATS 64
+#define PROFILE_BUCKETS 256  // duration histogram buckets per stage, 4 per power of two
+#define PROFILE_STRIDE 256   // headless ticks per profiled tick of physics stages
+#define PROFILE_TRACE_EVENTS (1 << 20)
+#define COMMAND_QUEUE_SIZE 64 // control commands waiting for a tick, a power of two
+#define ENTRY_LENGTH 16       // characters of a value typed into the cockpit
+#define SNAPSHOT_CODE 16     // bytes per airport or aircraft code in a snapshot blob
+#define SNAPSHOT_MAX_SIZE (sizeof(struct SnapshotHeader) + (MAX_WAYPOINTS + 3) * SNAPSHOT_CODE + \
+                           sizeof(struct FlightData) + sizeof(struct Weather))
 
-// Aircraft types
-typedef enum {
-    AIRCRAFT_CESSNA,
-    AIRCRAFT_BOEING737,
-    AIRCRAFT_AIRBUS320
-} AircraftType;
+// SIMD vector layer for the fleet kernels: AVX2 steps 8 aircraft per
+// vector, SSE2 steps 4. Without either (or with -DAPM_NO_SIMD) the kernels
+// use libm per aircraft.
+#if defined(APM_NO_SIMD)
+#define SIMD_NAME "scalar"
+#elif defined(__AVX2__)
+#define SIMD_NAME "AVX2"
+#define SIMD_LANES 8
+typedef __m256 vfloat;
+typedef __m256i vint;
+#define vset(x) _mm256_set1_ps(x)
+#define vload(p) _mm256_loadu_ps(p)
+#define vstore(p, v) _mm256_storeu_ps(p, v)
+#define vloadi(p) _mm256_loadu_si256((const __m256i*)(p))
+#define vadd _mm256_add_ps
+#define vsub _mm256_sub_ps
+#define vmul _mm256_mul_ps
+#define vdiv _mm256_div_ps
+#define vsqrt _mm256_sqrt_ps
+#define vmax _mm256_max_ps
+#define vmin _mm256_min_ps
+#define vand _mm256_and_ps
+#define vxor _mm256_xor_ps
+#define vandnot _mm256_andnot_ps
+#define vgt(a, b) _mm256_cmp_ps(a, b, _CMP_GT_OQ)
+#define vlt(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define vselect(m, a, b) _mm256_blendv_ps(b, a, m)
+#define vtoint _mm256_cvtps_epi32
+#define vtrunc _mm256_cvttps_epi32
+#define vtofloat _mm256_cvtepi32_ps
+#define vgather(table, index) _mm256_i32gather_ps(table, index, 4)
+#define viset _mm256_set1_epi32
+#define viand _mm256_and_si256
+#define viadd _mm256_add_epi32
+#define vieq(a, b) _mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b))
+#elif defined(__SSE2__)
+#define SIMD_NAME "SSE2"
+#define SIMD_LANES 4
+typedef __m128 vfloat;
+typedef __m128i vint;
+#define vset(x) _mm_set1_ps(x)
+#define vload(p) _mm_loadu_ps(p)
+#define vstore(p, v) _mm_storeu_ps(p, v)
+#define vloadi(p) _mm_loadu_si128((const __m128i*)(p))
+#define vadd _mm_add_ps
+#define vsub _mm_sub_ps
+#define vmul _mm_mul_ps
+#define vdiv _mm_div_ps
+#define vsqrt _mm_sqrt_ps
+#define vmax _mm_max_ps
+#define vmin _mm_min_ps
+#define vand _mm_and_ps
+#define vxor _mm_xor_ps
+#define vandnot _mm_andnot_ps
+#define vgt(a, b) _mm_cmpgt_ps(a, b)
+#define vlt(a, b) _mm_cmplt_ps(a, b)
+#define vselect(m, a, b) _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b))
+#define vtoint _mm_cvtps_epi32
+#define vtrunc _mm_cvttps_epi32
+#define vtofloat _mm_cvtepi32_ps
+#define vgather(table, index) sseGather(table, index)
+#define viset _mm_set1_epi32
+#define viand _mm_and_si128
+#define viadd _mm_add_epi32
+#define vieq(a, b) _mm_castsi128_ps(_mm_cmpeq_epi32(a, b))
+static inline __m128 sseGather(const float* table, __m128i index) { // no gather before AVX2
+    int lane[4];
+    _mm_storeu_si128((__m128i*)lane, index);
+    return _mm_setr_ps(table[lane[0]], table[lane[1]], table[lane[2]], table[lane[3]]);
+}
+#else
+#define SIMD_NAME "scalar"
+#endif
+
+// Stages timed by the profiler: main loop phases, physics stages and
+// the cockpit's panel draws
+#define PROFILE_STAGES(X) \
+    X(EVENTS, "events") X(UPDATE_FLIGHT, "updateFlight") X(AERODYNAMICS, "calculateAerodynamics") \
+    X(WIND_EFFECT, "calculateWindEffect") X(NAVIGATION, "updateNavigation") \
+    X(ENVELOPE, "checkFlightEnvelope") X(INSTRUMENTS, "updateInstruments") X(WEATHER, "updateWeather") \
+    X(LOGGING, "logging") X(RENDER, "renderCockpit") X(DRAW_ATTITUDE, "drawAttitudeIndicator") \
+    X(DRAW_GAUGE, "drawGauge") X(DRAW_MAP, "drawMap") X(DRAW_TEXT, "drawText") \
+    X(DRAW_STATIC_TEXT, "drawStaticText") X(PRESENT, "present")
+#define X(id, name) STAGE_##id,
+enum { PROFILE_STAGES(X) NUM_STAGES };
+#undef X
+
+// Scoped timers, built with -DAPM_PROFILE and compiled out otherwise.
+// PROFILE(stage, code) times one statement, PROFILE_BEGIN/PROFILE_END a
+// block. A physics stage costs about as much as a timer, so
+// PROFILE_SAMPLED times it only on one tick in profile_stride (see
+// PROFILE_TICK) to keep the overhead under 1% of a tick.
+#ifdef APM_PROFILE
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define profileNow() __rdtsc()
+#define PROFILE_CLOCK "TSC"
+#else
+#define profileNow() SDL_GetPerformanceCounter()
+#define PROFILE_CLOCK "performance counter"
+#endif
+
+// Time spent in one stage: totals and a histogram in clock ticks, four
+// buckets per power of two
+struct ProfileStage {
+    uint64_t count, total, min, max;
+    uint32_t buckets[PROFILE_BUCKETS];
+};
+
+// One timed scope, kept for the trace export
+struct ProfileEvent {
+    uint64_t start;
+    uint32_t ticks;
+    uint32_t stage;
+};
+
+struct ProfileStage profile_stages[NUM_STAGES];
+struct ProfileEvent* profile_trace = NULL; // NULL unless a trace was requested
+int profile_trace_count = 0;
+int profile_stride = PROFILE_STRIDE;       // physics stages timed every Nth tick
+int profile_sampled = 1;                   // time this tick's sampled stages
+unsigned int profile_ticks = 0;
+uint64_t profile_clock_start = 0;          // clock reading at profileInit()
+Uint64 profile_counter_start = 0;          // SDL performance counter at profileInit()
+double profile_overhead = 0;               // clock ticks one timed scope adds
+const char* profile_trace_path = NULL;
+
+// Histogram bucket of a duration
+static inline int profileBucket(uint64_t ticks) {
+    if (ticks < 4) return (int)ticks;
+    int msb = 63 - __builtin_clzll(ticks);
+    return msb * 4 + (int)((ticks >> (msb - 2)) & 3);
+}
+
+// Close a scope that started at start. Kept out of line so only the
+// clock reads sit in the instrumented code.
+static __attribute__((noinline)) void profileRecord(int stage, uint64_t start) {
+    uint64_t ticks = profileNow() - start;
+    struct ProfileStage* s = &profile_stages[stage];
+    if (s->count == 0 || ticks < s->min) s->min = ticks;
+    if (ticks > s->max) s->max = ticks;
+    s->count++;
+    s->total += ticks;
+    s->buckets[profileBucket(ticks)]++;
+    if (profile_trace && profile_trace_count < PROFILE_TRACE_EVENTS) {
+        profile_trace[profile_trace_count++] = (struct ProfileEvent){start, (uint32_t)ticks, (uint32_t)stage};
+    }
+}
+
+#define PROFILE_BEGIN(start) uint64_t start = profileNow()
+#define PROFILE_END(stage, start) profileRecord(stage, start)
+#define PROFILE(stage, code) do { PROFILE_BEGIN(profile_start); code; PROFILE_END(stage, profile_start); } while (0)
+#define PROFILE_SAMPLED(stage, code) do { \
+        uint64_t profile_start = profile_sampled ? profileNow() : 0; \
+        code; \
+        if (profile_sampled) PROFILE_END(stage, profile_start); \
+    } while (0)
+#define PROFILE_TICK() (profile_sampled = profile_ticks++ % profile_stride == 0)
+#define PROFILE_SET_STRIDE(n) (profile_stride = (n))
+#else
+#define PROFILE_BEGIN(start)
+#define PROFILE_END(stage, start)
+#define PROFILE(stage, code) do { code; } while (0)
+#define PROFILE_SAMPLED(stage, code) do { code; } while (0)
+#define PROFILE_TICK()
+#define PROFILE_SET_STRIDE(n)
+#endif
+
+// Built-in aircraft: enum suffix, code, name, then the struct
+// AircraftPerformance fields in order. Each also gets fleet kernels
+// specialised on its constants (see FLEET_SPECIALIZED below).
+#define BUILTIN_AIRCRAFT(X) \
+    X(CESSNA, "C172", "Cessna 172", 160, 14000, 56, 1670, 2550, 230, 10, 47, 163, 126, 85, 2000) \
+    X(BOEING737, "B737", "Boeing 737", 350, 41000, 6875, 91000, 174200, 27000, 2500, 108, 350, 280, 230, 6500) \
+    X(AIRBUS320, "A320", "Airbus A320", 350, 39800, 6875, 93000, 170000, 27000, 2500, 108, 350, 280, 230, 6500)
+
+// Performance fields in struct AircraftPerformance order, as named in
+// aircraft data files
+#define PERF_FIELDS(X) \
+    X(max_speed) X(max_altitude) X(max_fuel) X(empty_weight) X(max_weight) X(max_thrust) \
+    X(fuel_flow) X(stall_speed) X(vne) X(vno) X(vfe) X(min_runway)
+
+// Aircraft types: an index into aircraft_profiles, the built-ins first,
+// then any loaded with --aircraft
+#define X(id, ...) AIRCRAFT_##id,
+enum { BUILTIN_AIRCRAFT(X) NUM_AIRCRAFT_TYPES };
+#undef X
+typedef int AircraftType;
 
 // Weather structure
 struct Weather {
     float wind_speed;      // knots
-    float wind_direction;  // degrees
-    float temperature;     // Celsius
+    float wind_direction;  // degrees, the way the wind blows toward
+    float temperature;     // Celsius, outside air at the aircraft
     float pressure;       // hPa
     float visibility;     // nm
     int precipitation;    // 0=none, 1=rain, 2=snow
@@ -35,14 +327,33 @@ struct Weather {
 
 // Airport structure
 struct Airport {
-    char name[20];
-    char code[4];
+    const char* name;     // interned
+    const char* code;     // interned
     float lat;
     float lon;
     float elevation;      // ft
     float runway_length; // ft
     float runway_heading; // degrees
     int has_ils;         // 0 or 1
+    int waypoint;        // 1 = navigation fix, not an airfield
+};
+
+// Interned strings: every distinct string stored once in arena blocks
+// that never move, so the pointers can be compared and kept
+struct StringPool {
+    char* block;          // current block, starts with the previous block's pointer
+    size_t used;
+    const char** table;   // open-addressing hash set
+    size_t table_size;
+    size_t count;
+};
+
+// Airport spatial index: 1 degree lat/lon cells, airports grouped by cell
+struct AirportGrid {
+    int* cell_start;      // GRID_ROWS * GRID_COLS + 1 offsets into items
+    int* items;           // airport indices
+    int* code_table;      // open-addressing code -> index + 1
+    int code_table_size;
 };
 
 // FlightData structure
@@ -61,7 +372,7 @@ struct FlightData {
     float indicated_airspeed; // kt
     float mach_number;    // Mach
     float g_force;        // G
-    float temperature;    // C
+    float temperature;    // C at the surface, sets the deviation from ISA
     float pressure;       // hPa
     float density_altitude; // ft
     float lat;           // latitude
@@ -73,6 +384,9 @@ struct FlightData {
     int autopilot;       // 0=off, 1=on
     int transponder;     // 0=off, 1=on
     AircraftType type;   // Aircraft type
+    int leg;             // active flight plan leg
+    float along_track;   // nm flown along the active leg
+    float cross_track;   // nm right of the active leg
 };
 
 // Aircraft performance
@@ -88,59 +402,678 @@ struct AircraftPerformance {
     float vne;           // knots
     float vno;           // knots
     float vfe;           // knots
+    float min_runway;    // ft, shortest usable runway
+};
+
+// Aircraft type or per-tail variant in the performance database
+struct AircraftProfile {
+    const char* code;    // e.g. "B737" or a registration, interned
+    const char* name;    // interned
+    struct AircraftPerformance perf;
+};
+
+// Diversion search input: where the aircraft is and how fast it can get anywhere
+struct DiversionQuery {
+    float lat, lon;
+    float speed;          // true airspeed, kt
+    float wind_speed;     // kt
+    float wind_direction; // degrees, toward, as struct Weather
+    float visibility;     // nm
+    const struct AircraftPerformance* perf;
+};
+
+// Ranked diversion candidate
+struct Diversion {
+    int airport;
+    float distance;       // nm
+    float fuel;           // gal to reach
+};
+
+// Flight plan leg: a piece of great circle short enough to fly as a
+// straight line, tracked incrementally from its start point
+struct FlightLeg {
+    float lat, lon;       // start
+    float course;         // deg true
+    float course_sin, course_cos;
+    float length;         // nm
+    float remaining;      // nm of the legs after this one
+    int fix;              // airport or waypoint the leg leads to
+};
+
+// Flight plan: departure, via fixes and destination as a leg table,
+// precomputed once when the plan is loaded
+struct FlightPlan {
+    int leg_count;
+    float total;          // nm
+    struct FlightLeg legs[MAX_PLAN_LEGS];
+};
+
+// Complete state of the single-aircraft simulation: everything
+// stepSimulation() reads or writes besides the constant tables. Plain
+// data, so forking a flight is one struct copy.
+struct Snapshot {
+    struct FlightData plane;
+    struct Weather weather;
+    int flight_time;
+    int warning_count;
+    unsigned int seed;
+    int tick, substeps;
+    int dep, dest;
+    int via[MAX_WAYPOINTS];
+    int via_count;
+    struct FlightPlan plan;
+};
+
+// One --bench measurement
+struct BenchResult {
+    const char* name;
+    int aircraft;
+    const char* unit;     // "ns/tick" per aircraft, or "ns/frame"
+    double median_ns;
+    double min_ns;
+};
+
+// Snapshot blob header. Then come via_count + 3 codes of SNAPSHOT_CODE
+// bytes (aircraft type, departure, via fixes, destination), the flight
+// data and the weather, all in host byte order.
+struct SnapshotHeader {
+    char magic[4];        // "APMS"
+    uint16_t version;     // SNAPSHOT_VERSION
+    uint16_t via_count;
+    int32_t flight_time;
+    int32_t warning_count;
+    uint32_t seed;
+    int32_t tick;
+    int32_t substeps;
+};
+
+// International Standard Atmosphere against pressure altitude, tabulated
+// every ISA_STEP ft from ISA_FLOOR by initAtmosphere() and read with linear
+// interpolation (isaLookup(), visaLookup()). A row falls on the tropopause
+// so the temperature kink is exact. Interpolation error is below 2e-5
+// relative for every column, checked by --check-kernels. Altitudes outside
+// the table are clamped to its ends (about -2,160 to 70,090 ft).
+struct Atmosphere {
+    float density_ratio[ISA_ROWS + 1]; // rho / rho0, last row repeated for interpolation
+    float density_sqrt[ISA_ROWS + 1];  // sqrt(rho / rho0): IAS = TAS * this
+    float pressure[ISA_ROWS + 1];      // hPa
+    float temperature[ISA_ROWS + 1];   // C
+    float sound_speed[ISA_ROWS + 1];   // kt
+};
+
+// Fleet columns: one contiguous array per FlightData field, plus the
+// per-aircraft weather and bookkeeping the step functions need. course_sin
+// and course_cos are the active leg's, zero without a plan.
+#define FLEET_FLOAT_COLUMNS(X) \
+    X(altitude) X(speed) X(fuel) X(throttle) X(heading) X(bank_angle) \
+    X(turn_radius) X(distance_remaining) X(vertical_speed) X(ground_speed) \
+    X(true_airspeed) X(indicated_airspeed) X(mach_number) X(g_force) \
+    X(temperature) X(pressure) X(density_altitude) X(lat) X(lon) \
+    X(prev_altitude) X(wind_speed) X(wind_direction) X(air_temperature) \
+    X(air_pressure) X(along_track) X(cross_track) X(course_sin) X(course_cos)
+#define FLEET_INT_COLUMNS(X) \
+    X(phase) X(flaps) X(gear) X(autopilot) X(transponder) X(type) \
+    X(active) X(flight_time) X(warnings) X(rng_stream) X(leg) X(plan)
+
+// Fleet of aircraft in struct-of-arrays layout
+struct Fleet {
+    int count;
+    int capacity;         // multiple of 16 so kernels can run whole vectors
+    unsigned int seed;    // weather random seed shared by every rng_stream
+    int tick;             // seconds per tick
+    int substeps;         // physics steps per tick
+    void* block;          // single allocation backing every column
+#define X(name) float* name;
+    FLEET_FLOAT_COLUMNS(X)
+#undef X
+#define X(name) int* name;
+    FLEET_INT_COLUMNS(X)
+#undef X
+    struct AircraftPerformance* perf; // copy of every profile's performance, by type
+    struct FlightPlan* plans; // routes flown, indexed by the plan column (-1: none)
+    int plan_count;
+    int plan_capacity;
+};
+
+// Binary flight log columns. The file is a LogHeader followed by blocks of
+// up to LOG_BLOCK_TICKS ticks: a uint32 tick count, then each column's values
+// back to back (time, floats, bytes). A zero tick count ends a flight; batch
+// runs append several flights to one file.
+// All values are in the writing host's byte order; the header's byte_order
+// field lets a reader on the other byte order refuse the file.
+#define LOG_FLOAT_COLUMNS(X) \
+    X(altitude) X(speed) X(ground_speed) X(heading) X(bank_angle) \
+    X(vertical_speed) X(fuel) X(distance_remaining)
+#define LOG_BYTE_COLUMNS(X) X(phase) X(flaps) X(flags)
+#define LOG_FLAG_GEAR 1
+#define LOG_FLAG_AUTOPILOT 2
+#define LOG_FLAG_TRANSPONDER 4
+
+// Pilot controls recorded in the input journal
+#define JOURNAL_CONTROLS(X) X(throttle) X(bank_angle) X(flaps) X(gear) X(autopilot) X(transponder)
+
+// Controls a command can change, the ones set by a typed value first
+enum { CONTROL_THROTTLE, CONTROL_BANK_ANGLE, CONTROL_FLAPS, CONTROL_GEAR, CONTROL_AUTOPILOT, CONTROL_TRANSPONDER };
+
+// A control change waiting for the next tick; toggles ignore value
+struct ControlCommand {
+    int control;
+    float value;
+};
+
+// Control commands from input handlers, applied at the next tick boundary
+// so the simulation never waits for input. A single-producer/
+// single-consumer ring like struct AsyncLog's.
+struct CommandQueue {
+    struct ControlCommand items[COMMAND_QUEUE_SIZE];
+    SDL_atomic_t head;    // next slot to write, producer owned
+    SDL_atomic_t tail;    // next slot to read, consumer owned
+};
+
+// Value being typed into the cockpit after T, B or F; control is -1
+// when no entry is open
+struct ControlEntry {
+    int control;
+    char text[ENTRY_LENGTH];
+    int length;
+};
+
+// Binary flight log header, written once per file
+struct LogHeader {
+    char magic[4];        // "APMB"
+    uint16_t version;     // LOG_SCHEMA_VERSION
+    uint16_t block_ticks;
+    int32_t aircraft_type;
+    uint32_t byte_order;  // LOG_BYTE_ORDER
+    char dep_code[SNAPSHOT_CODE];
+    char dest_code[SNAPSHOT_CODE];
+    char dep_name[LOG_NAME];
+    char dest_name[LOG_NAME];
+};
+
+// Binary flight log writer, buffers one block of ticks per column
+struct LogRecorder {
+    FILE* file;
+    uint32_t count;
+    int32_t time[LOG_BLOCK_TICKS];
+#define X(name) float name[LOG_BLOCK_TICKS];
+    LOG_FLOAT_COLUMNS(X)
+#undef X
+#define X(name) uint8_t name[LOG_BLOCK_TICKS];
+    LOG_BYTE_COLUMNS(X)
+#undef X
+};
+
+// What the async logger does when its ring is full
+typedef enum {
+    LOG_BLOCK,            // wait for the writer
+    LOG_DROP_NEWEST,      // drop the record being queued
+    LOG_GROW              // spill into an unbounded overflow list
+} LogBackpressure;
+
+// One tick snapshot queued for the log writer
+struct LogRecord {
+    int time;
+    int end;              // 1 = end of flight marker
+    struct FlightData data;
+};
+
+// Telemetry datagram header. frame_count struct LogRecord frames follow in
+// host byte order, so publisher and subscribers must share a machine.
+struct TelemetryHeader {
+    char magic[4];        // "APMT"
+    uint16_t version;     // TELEMETRY_VERSION
+    uint16_t frame_count;
+    uint32_t sequence;    // datagram number, a gap means datagrams were lost
+    uint32_t frame_size;  // sizeof(struct LogRecord), checked by subscribers
+};
+
+// A dashboard or recorder receiving telemetry, dropped after
+// TELEMETRY_TIMEOUT ms without a keepalive
+struct TelemetrySubscriber {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    Uint32 seen;          // SDL_GetTicks() of its last subscribe
+};
+
+// Telemetry publisher: a non-blocking datagram socket bound where
+// subscribers send "subscribe". Only the async log writer thread uses it.
+struct Telemetry {
+    TelemetrySocket socket;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    struct TelemetrySubscriber subscribers[TELEMETRY_MAX_SUBSCRIBERS];
+    int subscriber_count;
+    uint32_t sequence;
+    long long frames;     // frames sent, counted once per subscriber
+    long long dropped;    // frames not sent because a socket buffer was full
+};
+
+// Asynchronous log writer: a single-producer/single-consumer ring drained
+// by a background thread in batches. Head and tail only ever increase;
+// the slot is the counter masked by LOG_RING_SIZE - 1.
+struct AsyncLog {
+    struct LogRecord ring[LOG_RING_SIZE];
+    SDL_atomic_t head;    // next slot to write, producer owned
+    char pad_head[60];
+    SDL_atomic_t tail;    // next slot to read, writer owned
+    char pad_tail[60];
+    LogBackpressure policy;
+    struct LogRecord* overflow; // LOG_GROW spill list, producer only
+    int overflow_start;
+    int overflow_count;
+    int overflow_capacity;
+    int overflow_peak;
+    SDL_atomic_t dropped;
+    long long written;
+    SDL_atomic_t quit;
+    SDL_sem* wake;        // producer -> writer
+    SDL_sem* space;       // writer -> blocked producer
+    SDL_Thread* thread;
+    FILE* text;
+    struct LogRecorder* recorder;
+    struct Telemetry* telemetry; // also streams every batch, or NULL
+    const char* dep;
+    const char* dest;
+    struct LogRecord batch[LOG_WRITE_BATCH]; // writer's copy of the ring
+    char buffer[LOG_WRITE_BATCH * 256];      // formatted text batch
+};
+
+// Read-only file mapping, viewed a window at a time so multi-GB files
+// never need to fit in memory or the address space
+struct MappedFile {
+    long long size;
+    long long granularity; // view offsets must be a multiple of this
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+};
+
+// Weather grid file header (--weather), followed by the tiles in host byte
+// order. The grid has lat_count x lon_count points lat_step and lon_step deg
+// apart from (lat0, lon0), level_count altitudes level_step ft apart from
+// level0, and time_count slices time_step s of flight time apart. It is cut
+// into tiles of WEATHER_TILE x WEATHER_TILE cells, stored slice by slice,
+// then south to north, then west to east. A tile holds the corner points of
+// its cells at every level, so points on a tile edge are stored in both
+// neighbours and a lookup reads one tile per slice. Each point is
+// WEATHER_FIELDS floats, ordered by level, row, column.
+struct WeatherHeader {
+    char magic[4];        // "APMW"
+    uint16_t version;     // WEATHER_VERSION
+    uint16_t tile;        // WEATHER_TILE
+    int32_t lat_count, lon_count, level_count, time_count;
+    float lat0, lon0;     // deg
+    float lat_step, lon_step; // deg
+    float level0, level_step; // ft
+    float time_step;      // s
+    uint32_t reserved;
+};
+
+// Recently used weather tiles, copied out of the mapping into one arena so
+// the fleet kernels can gather any cell corner with a 32-bit index. One
+// cache per worker, so lookups need no locks.
+struct WeatherCache {
+    float* tiles;         // WEATHER_SETS * WEATHER_WAYS tiles
+    int key[WEATHER_SETS * WEATHER_WAYS];  // tile number in the file, -1 if empty
+    unsigned long long used[WEATHER_SETS * WEATHER_WAYS]; // LRU stamps
+    unsigned long long clock;
+    unsigned char index[WEATHER_INDEX]; // likely slot of a tile by key, checked against key[]
+    long long loads;      // tiles read from the file
+};
+
+// Gridded weather loaded with --weather. Only the cached tiles are ever
+// resident, so the file can be far larger than memory.
+struct WeatherGrid {
+    struct WeatherHeader header;
+    struct MappedFile file;
+    int tiles_lat, tiles_lon; // tiles per slice in each direction
+    int tile_floats;
+    float lat_scale, lon_scale, level_scale, time_scale; // 1 / step, 0 for a single time slice
+    struct WeatherCache* cache[MAX_WORKERS];
+};
+
+// Glyph atlas: every glyph rasterized once into a single texture
+struct GlyphAtlas {
+    SDL_Texture* texture;
+    int width, height;
+    int line_skip;
+    SDL_Rect glyphs[ATLAS_GLYPHS];
+    int advance[ATLAS_GLYPHS];
+};
+
+// Static label pre-rendered to its own texture
+struct CachedText {
+    const char* text;
+    SDL_Color color;
+    SDL_Texture* texture;
+    int w, h;
+};
+
+// Cockpit panels, in drawing order
+typedef enum {
+    PANEL_ATTITUDE,
+    PANEL_AIRSPEED,   // dial gauges, in the order of the gauges table
+    PANEL_ALTIMETER,
+    PANEL_HEADING,
+    PANEL_VSI,
+    PANEL_MACH,
+    PANEL_FUEL,
+    PANEL_MAP,
+    PANEL_INFO,
+    PANEL_CONTROLS,
+    NUM_PANELS
+} CockpitPanelId;
+
+// Dial gauge: fixed face description plus tick geometry built once per size
+struct Gauge {
+    const char* label;
+    const char* unit;      // appended to the readout
+    int decimals;          // readout decimals; 0 truncates like the original dials
+    float start, sweep;    // needle angle (rad, clockwise from 3 o'clock) at min, and the arc covered
+    SDL_Color needle;
+    int built_size;
+    int tick_count;
+    SDL_Point ticks[2 * MAX_GAUGE_TICKS]; // inner/outer endpoint pairs, relative to the centre
+};
+
+// A panel's screen area and the inputs it was last drawn from
+struct CockpitPanel {
+    SDL_Rect bounds;
+    float inputs[PANEL_INPUTS];
+    int valid;
+};
+
+// Retained cockpit: the scene texture only changes where a panel changed
+struct Cockpit {
+    SDL_Texture* scene;
+    int width, height;
+    struct CockpitPanel panels[NUM_PANELS];
+    char info[512];
+    int present;  // scene must be copied to the window again
+    int repaint;  // scene contents lost: repaint all of it
+};
+
+// Flight log query results
+struct LogQuery {
+    long long lines;
+    long long ticks;
+    int flights;
+    long long warnings;
+    long long phase_time[NUM_PHASES + 1];   // last slot: unknown phase
+    double phase_fuel[NUM_PHASES + 1];      // gal burned while in phase
+    double max_altitude;
+    long long max_altitude_time;
+    int max_altitude_flight;
+    int in_flight;                          // ticks seen since the last [END]
+    int have_fuel;                          // previous tick's fuel is valid
+    double last_fuel;
+    long long last_time;
+};
+
+// Scheduler queue: a packed [next, end) range of chunk indices. The owner
+// pops from the front, idle workers steal from the back.
+struct WorkQueue {
+    SDL_atomic_t range;
+    char pad[60];         // one queue per cache line
+};
+
+// Pool worker thread
+struct PoolWorker {
+    struct ThreadPool* pool;
+    int id;
+    SDL_Thread* thread;
+    SDL_sem* start;
+};
+
+// Fleet stepping thread pool, the calling thread is worker 0
+struct ThreadPool {
+    int workers;
+    struct PoolWorker worker[MAX_WORKERS];
+    SDL_sem* done;
+    int quit;
+    struct WorkQueue queues[MAX_WORKERS];
+    struct Fleet* fleet;  // current job
+    int chunk_size;
+    int max_ticks;
+    SDL_atomic_t flying;
 };
 
 // Global variables
-struct Airport airports[MAX_AIRPORTS] = {
-    {"Colombo (CMB)", "CMB", 6.9271, 79.8612, 7, 11000, 4, 1},
-    {"Delhi (DEL)", "DEL", 28.6139, 77.2090, 777, 12500, 28, 1},
-    {"Mumbai (BOM)", "BOM", 19.0887, 72.8679, 37, 11400, 9, 1},
-    {"Bangalore (BLR)", "BLR", 13.1979, 77.7063, 3016, 12000, 9, 1},
-    {"Chennai (MAA)", "MAA", 12.9900, 80.1634, 52, 12000, 7, 1},
-    {"Kathmandu (KTM)", "KTM", 27.6966, 85.3591, 4390, 10000, 2, 0},
-    {"Dhaka (DAC)", "DAC", 23.8433, 90.4082, 30, 10500, 14, 1},
-    {"Singapore (SIN)", "SIN", 1.3644, 103.9915, 22, 13000, 2, 1},
-    {"Kuala Lumpur (KUL)", "KUL", 2.7456, 101.7071, 69, 12400, 14, 1},
-    {"Bangkok (BKK)", "BKK", 13.9125, 100.6068, 5, 12000, 19, 1}
-};
-
-struct Weather current_weather = {
+const struct Airport builtin_airports[MAX_AIRPORTS] = {
+    {"Colombo (CMB)", "CMB", 6.9271, 79.8612, 7, 11000, 4, 1, 0},
+    {"Delhi (DEL)", "DEL", 28.6139, 77.2090, 777, 12500, 28, 1, 0},
+    {"Mumbai (BOM)", "BOM", 19.0887, 72.8679, 37, 11400, 9, 1, 0},
+    {"Bangalore (BLR)", "BLR", 13.1979, 77.7063, 3016, 12000, 9, 1, 0},
+    {"Chennai (MAA)", "MAA", 12.9900, 80.1634, 52, 12000, 7, 1, 0},
+    {"Kathmandu (KTM)", "KTM", 27.6966, 85.3591, 4390, 10000, 2, 0, 0},
+    {"Dhaka (DAC)", "DAC", 23.8433, 90.4082, 30, 10500, 14, 1, 0},
+    {"Singapore (SIN)", "SIN", 1.3644, 103.9915, 22, 13000, 2, 1, 0},
+    {"Kuala Lumpur (KUL)", "KUL", 2.7456, 101.7071, 69, 12400, 14, 1, 0},
+    {"Bangkok (BKK)", "BKK", 13.9125, 100.6068, 5, 12000, 19, 1, 0}
+};
+struct Airport* airports = NULL;   // built-in network first, then any loaded from file
+int airport_count = 0;
+int airport_capacity = 0;
+struct StringPool strings = {0};
+struct AirportGrid airport_grid = {0};
+
+const struct Weather initial_weather = {
     10.0, 270.0, 15.0, 1013.25, 10.0, 0
 };
 
+struct Weather current_weather;
+struct WeatherGrid* weather_grid = NULL; // --weather, otherwise a random walk per flight
+struct Atmosphere isa;         // filled by initAtmosphere() at startup
+float route_distance[MAX_AIRPORTS][MAX_AIRPORTS]; // nm, filled by buildRouteMatrix()
+int route_matrix_built = 0;
+
 struct FlightData plane = {0};
 struct AircraftPerformance perf;
+#define X(id, code, name, ...) {code, name, {__VA_ARGS__}},
+static const struct AircraftProfile builtin_aircraft[NUM_AIRCRAFT_TYPES] = { BUILTIN_AIRCRAFT(X) };
+#undef X
+struct AircraftProfile* aircraft_profiles = NULL; // built-ins first, then any loaded from file
+int aircraft_type_count = 0;
+int aircraft_capacity = 0;
 SDL_Window* window = NULL;
 SDL_Renderer* renderer = NULL;
+SDL_Surface* offscreen_surface = NULL; // render target of the software renderer (--bench)
 TTF_Font* font = NULL;
+struct GlyphAtlas atlas = {0};
+struct CachedText text_cache[TEXT_CACHE_SIZE];
+int text_cache_count = 0;
+struct Cockpit cockpit = {0};
+const int panel_layout[NUM_PANELS][3] = { // centre x, y and dial size; text panels: top left
+    {100, 100, 150},
+    {300, 100, 100}, {500, 100, 100}, {300, 300, 100}, {500, 300, 100}, {700, 100, 100}, {700, 300, 100},
+    {600, 480, 150}, {10, 10, 0}, {10, 400, 0}
+};
+struct Gauge gauges[NUM_GAUGES] = {
+    {"Airspeed", " kt", 0, -PI/2, 2 * PI, {255, 0, 0, 255}, 0, 0, {{0, 0}}},
+    {"Altitude", " ft", 0, -PI/2, 2 * PI, {0, 255, 0, 255}, 0, 0, {{0, 0}}},
+    {"Heading", "\xC2\xB0", 0, -PI/2, 2 * PI, {0, 0, 255, 255}, 0, 0, {{0, 0}}},
+    {"Vert Speed", " fpm", 0, 0.1 * PI, 1.8 * PI, {255, 255, 0, 255}, 0, 0, {{0, 0}}}, // zero at 9 o'clock
+    {"Mach", "", 2, 0.75 * PI, 1.5 * PI, {255, 128, 0, 255}, 0, 0, {{0, 0}}},
+    {"Fuel", " gal", 0, 0.75 * PI, 1.5 * PI, {0, 255, 255, 255}, 0, 0, {{0, 0}}},
+};
+const char* control_prompts[] = {"Enter throttle (0-1): ", "Enter bank angle (0-30 deg): ", "Enter flaps (0-40 deg): "};
+struct CommandQueue control_commands;
+struct ControlEntry control_entry = {-1, "", 0};
+const char* controls_text = "Controls:\nT: Throttle\nB: Bank Angle\nF: Flaps\nG: Gear\nA: Autopilot\nX: Transponder\nK/L: Save/Load state\nQ: Quit";
 int flight_time = 0;
+int sim_tick = 1;         // simulated seconds per tick (one log line)
+int sim_substeps = 1;     // physics steps per tick
+struct FlightData display; // what the cockpit shows: interpolated between ticks
 int dep_idx = 0, dest_idx = 1;
+int route_via[MAX_WAYPOINTS]; // fixes flown between departure and destination
+int route_via_count = 0;
+struct FlightPlan flight_plan; // leg table of the current flight, built by initFlight()
 int running = 1;
+unsigned int sim_seed = 0; // weather random seed
+int quiet = 0;            // suppress console warnings (headless runs)
+int warning_count = 0;    // envelope warnings this flight
 
 // Function declarations
+struct AircraftPerformance getAircraftPerformance(AircraftType type);
+int addAircraftProfile(const struct AircraftProfile* profile);
+int findAircraftType(const char* code);
+int parseAircraftType(const char* text);
+int initAircraftProfiles(void);
+int loadAircraftProfiles(const char* path);
 void initAircraftPerformance(AircraftType type);
 void calculateAerodynamics(void);
-void updateWeather(void);
-void calculateWindEffect(void);
-void updateNavigation(void);
+void updateWeather(float dt, unsigned int step);
+void calculateWindEffect(float time);
+void initAtmosphere(void);
+void updateNavigation(float dt);
 void checkFlightEnvelope(void);
-void updateInstruments(void);
+void flightWarning(const char* message);
+void updateInstruments(float dt);
 void initFlight(void);
-void updateFlight(void);
+void updateFlight(float dt);
+void integrateStep(float dt, unsigned int step);
+void stepSimulation(void);
+void interpolateFlight(struct FlightData* out, const struct FlightData* from,
+                       const struct FlightData* to, float alpha);
+int flightComplete(void);
+void snapshotTake(struct Snapshot* snapshot);
+void snapshotRestore(const struct Snapshot* snapshot);
+size_t snapshotEncode(const struct Snapshot* snapshot, unsigned char* out, size_t size);
+int snapshotDecode(struct Snapshot* snapshot, const unsigned char* in, size_t size);
+int snapshotSave(const struct Snapshot* snapshot, const char* path);
+int snapshotLoad(struct Snapshot* snapshot, const char* path);
+FILE* journalOpen(const char* path);
+void journalControls(FILE* journal, int time, struct FlightData* journaled);
+void journalRestore(FILE* journal, int time, const struct Snapshot* snapshot);
+void journalClose(FILE* journal, int time);
+int commandPush(struct CommandQueue* queue, int control, float value);
+void commandApply(struct CommandQueue* queue, struct FlightData* aircraft);
+void entryBegin(int control);
+void entryText(const char* text);
+void entryKey(SDL_Keycode key, struct CommandQueue* queue);
 const char* getPhaseName(int phase);
+const char* getAircraftName(AircraftType type);
+const char* getAircraftCode(AircraftType type);
+unsigned int rngCounter(unsigned int seed, unsigned int stream, unsigned int counter);
+float rngUniform(unsigned int seed, unsigned int stream, unsigned int counter);
+float rngNormal(unsigned int seed, unsigned int stream, unsigned int counter);
+int findAirport(const char* code);
+const char* internString(const char* text);
+int addAirport(const struct Airport* airport);
+int initAirports(void);
+int loadAirports(const char* path);
+int buildAirportIndex(void);
+int airportsInRect(float lat_min, float lat_max, float lon_min, float lon_max, int* out, int max);
+int nearestAirport(float lat, float lon);
+int findDiversions(const struct DiversionQuery* query, int k, struct Diversion* out);
+void fleetFindDiversions(const struct Fleet* fleet, int begin, int end, float visibility,
+                         int k, struct Diversion* out, int* found);
+int runDiversionQuery(int argc, char *argv[]);
 float calculateDistance(float lat1, float lon1, float lat2, float lon2);
+void buildRouteMatrix(void);
+float routeDistance(int dep, int dest);
+int buildFlightPlan(struct FlightPlan* plan, int dep, const int* via, int via_count, int dest);
+int buildDirectPlan(struct FlightPlan* plan, float lat, float lon, int dest);
+void divertAircraft(struct FlightData* aircraft, const struct FlightPlan* plan);
+int parseVia(const char* list);
 void logData(FILE* log);
+int formatLogLine(char* buffer, size_t size, int time, const struct FlightData* aircraft,
+                  const char* dep, const char* dest);
+struct LogRecorder* recorderOpen(const char* path, AircraftType type, int dep, int dest);
+void recorderAppend(struct LogRecorder* recorder, int time, const struct FlightData* aircraft);
+void recorderFlush(struct LogRecorder* recorder);
+void recorderEndFlight(struct LogRecorder* recorder);
+void recorderClose(struct LogRecorder* recorder);
+int convertLog(const char* in_path, const char* out_path);
+int mapOpen(struct MappedFile* map, const char* path);
+const char* mapView(struct MappedFile* map, long long offset, size_t length);
+void mapRelease(const char* view, size_t length);
+void mapClose(struct MappedFile* map);
+int weatherOpen(const char* path);
+int weatherCacheCreate(struct WeatherGrid* grid, int worker);
+int weatherLoad(struct WeatherGrid* grid, struct WeatherCache* cache, int key);
+void weatherSample(int worker, float lat, float lon, float altitude, float time, float* out);
+void weatherSynthetic(float lat, float lon, float altitude, float time, float* out);
+int writeWeatherGrid(const char* path);
+const char* findByte(const char* p, const char* end, char c);
+double parseNumber(const char* p, const char* end);
+void queryLine(struct LogQuery* query, const char* line, const char* end);
+int queryLog(const char* path);
+struct AsyncLog* asyncLogOpen(FILE* text, struct LogRecorder* recorder, struct Telemetry* telemetry,
+                              LogBackpressure policy, const char* dep, const char* dest);
+void asyncLogPush(struct AsyncLog* log, int time, int end, const struct FlightData* aircraft);
+int asyncLogTryPush(struct AsyncLog* log, const struct LogRecord* record);
+int asyncLogDrain(struct AsyncLog* log);
+int asyncLogThread(void* data);
+void asyncLogClose(struct AsyncLog* log);
+int telemetryAddress(const char* text, struct sockaddr_storage* addr, socklen_t* addr_len);
+struct Telemetry* telemetryOpen(const char* address);
+void telemetryPoll(struct Telemetry* telemetry);
+void telemetryPublish(struct Telemetry* telemetry, const struct LogRecord* records, int n);
+int telemetryWait(struct Telemetry* telemetry, int count, const char* address);
+void telemetryClose(struct Telemetry* telemetry);
+int runSubscriber(int argc, char *argv[]);
+int buildGlyphAtlas(void);
 void drawText(const char* text, int x, int y, SDL_Color color);
+void drawStaticText(const char* text, int x, int y, SDL_Color color);
+void measureText(const char* text, int* w, int* h);
+void initCockpit(void);
+void invalidateCockpit(int content);
 void drawAttitudeIndicator(int x, int y, int size);
-void drawAirspeedIndicator(int x, int y, int size);
-void drawAltimeter(int x, int y, int size);
-void drawHeadingIndicator(int x, int y, int size);
+void gaugeReading(int gauge, float* value, float* min, float* max);
+void buildGaugeGeometry(struct Gauge* gauge, int size);
+void drawGauge(struct Gauge* gauge, int x, int y, int size, float value, float min, float max);
 void drawMap(int x, int y, int size);
 void renderCockpit(void);
+int fleetAlloc(struct Fleet* fleet, int capacity);
+void fleetFree(struct Fleet* fleet);
+int fleetAddAircraft(struct Fleet* fleet, const struct FlightData* aircraft, const struct Weather* weather,
+                     const struct FlightPlan* plan);
+int fleetAddSnapshot(struct Fleet* fleet, const struct Snapshot* snapshot);
+void fleetLoad(const struct Fleet* fleet, int i, struct FlightData* aircraft);
+void fleetUpdateFlight(struct Fleet* fleet, int begin, int end, float dt);
+void fleetCalculateAerodynamics(struct Fleet* fleet, int begin, int end);
+void fleetCalculateWindEffect(struct Fleet* fleet, int begin, int end, float time, int worker);
+void fleetUpdateNavigation(struct Fleet* fleet, int begin, int end, float dt);
+void fleetCheckFlightEnvelope(struct Fleet* fleet, int begin, int end);
+void fleetUpdateInstruments(struct Fleet* fleet, int begin, int end, float dt);
+void fleetUpdateWeather(struct Fleet* fleet, int begin, int end, float dt, int substep);
+int fleetStep(struct Fleet* fleet, int begin, int end, int worker);
+struct ThreadPool* threadPoolCreate(int workers);
+void threadPoolDestroy(struct ThreadPool* pool);
+int threadPoolStepFleet(struct ThreadPool* pool, struct Fleet* fleet, int max_ticks);
+int takeChunk(struct WorkQueue* queue, int steal);
+void poolWork(struct ThreadPool* pool, int id);
+int poolWorkerThread(void* data);
+unsigned int fleetChecksum(const struct Fleet* fleet);
+void batchDistance(const float* lat1, const float* lon1, const float* lat2, const float* lon2,
+                   float* out, int n);
+int checkKernels(void);
+int runHeadless(int argc, char *argv[]);
+int compareFloats(const void* a, const void* b);
+int compareDoubles(const void* a, const void* b);
+void printDistribution(const char* name, float* values, int n);
+int runMonteCarlo(int argc, char *argv[]);
+int runRouteMatrix(int argc, char *argv[]);
+int runRestore(const char* path);
+int runFork(int argc, char *argv[]);
+int runReplay(int argc, char *argv[]);
+int runBenchmarks(int argc, char *argv[]);
+#ifdef APM_PROFILE
+int profileInit(const char* trace_path);
+void profileReport(void);
+int profileWriteTrace(const char* path);
+void profileShutdown(void);
+#endif
 
-// SDL initialization
-int initSDL(void) {
-    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+// SDL initialization. With offscreen set the cockpit is drawn by the
+// software renderer into a surface in memory, with no window or display.
+int initSDL(int offscreen) {
+    if (SDL_Init(offscreen ? 0 : SDL_INIT_VIDEO) < 0) {
         printf("SDL Init Error: %s\n", SDL_GetError());
         return 0;
     }
@@ -148,12 +1081,21 @@ int initSDL(void) {
         printf("TTF Init Error: %s\n", TTF_GetError());
         return 0;
     }
-    window = SDL_CreateWindow("Aircraft Performance Monitor", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 800, 600, 0);
-    if (!window) {
-        printf("Window Error: %s\n", SDL_GetError());
-        return 0;
+    if (offscreen) {
+        offscreen_surface = SDL_CreateRGBSurfaceWithFormat(0, 800, 600, 32, SDL_PIXELFORMAT_RGBA32);
+        if (!offscreen_surface) {
+            printf("Surface Error: %s\n", SDL_GetError());
+            return 0;
+        }
+        renderer = SDL_CreateSoftwareRenderer(offscreen_surface);
+    } else {
+        window = SDL_CreateWindow("Aircraft Performance Monitor", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 800, 600, 0);
+        if (!window) {
+            printf("Window Error: %s\n", SDL_GetError());
+            return 0;
+        }
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
     }
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
     if (!renderer) {
         printf("Renderer Error: %s\n", SDL_GetError());
         return 0;
@@ -163,26 +1105,175 @@ int initSDL(void) {
         printf("Font Error: %s\n", TTF_GetError());
         return 0;
     }
+    if (!buildGlyphAtlas()) {
+        printf("Glyph Atlas Error: %s\n", SDL_GetError());
+        return 0;
+    }
+    initCockpit();
     return 1;
 }
 
 // Cleanup SDL
 void cleanupSDL(void) {
+    for (int i = 0; i < text_cache_count; i++) SDL_DestroyTexture(text_cache[i].texture);
+    text_cache_count = 0;
+    if (cockpit.scene) SDL_DestroyTexture(cockpit.scene);
+    if (atlas.texture) SDL_DestroyTexture(atlas.texture);
     if (font) TTF_CloseFont(font);
     if (renderer) SDL_DestroyRenderer(renderer);
     if (window) SDL_DestroyWindow(window);
+    if (offscreen_surface) SDL_FreeSurface(offscreen_surface);
     TTF_Quit();
     SDL_Quit();
 }
 
-// Draw text
+// Rasterize printable ASCII and the degree sign once into one texture
+int buildGlyphAtlas(void) {
+    SDL_Surface* rendered[ATLAS_GLYPHS];
+    SDL_Color white = {255, 255, 255, 255};
+    int x = 0, y = 0, row_height = 0;
+    for (int g = 0; g < ATLAS_GLYPHS; g++) {
+        char text[3] = {(char)(32 + g), 0, 0};
+        Uint16 ch = (Uint16)(32 + g);
+        if (g == GLYPH_DEGREE) {
+            text[0] = (char)0xC2; text[1] = (char)0xB0; // UTF-8 degree sign
+            ch = 0xB0;
+        }
+        rendered[g] = TTF_RenderUTF8_Blended(font, text, white);
+        if (TTF_GlyphMetrics(font, ch, NULL, NULL, NULL, NULL, &atlas.advance[g]) < 0) {
+            atlas.advance[g] = rendered[g] ? rendered[g]->w : 0;
+        }
+        int w = rendered[g] ? rendered[g]->w : 0;
+        int h = rendered[g] ? rendered[g]->h : 0;
+        if (x + w > ATLAS_WIDTH) {
+            x = 0;
+            y += row_height + 1;
+            row_height = 0;
+        }
+        atlas.glyphs[g] = (SDL_Rect){x, y, w, h};
+        x += w + 1;
+        if (h > row_height) row_height = h;
+    }
+    atlas.width = ATLAS_WIDTH;
+    atlas.height = y + row_height;
+    atlas.line_skip = TTF_FontLineSkip(font);
+
+    SDL_Surface* sheet = SDL_CreateRGBSurfaceWithFormat(0, atlas.width, atlas.height, 32, SDL_PIXELFORMAT_RGBA32);
+    if (sheet) {
+        for (int g = 0; g < ATLAS_GLYPHS; g++) {
+            if (!rendered[g]) continue;
+            SDL_SetSurfaceBlendMode(rendered[g], SDL_BLENDMODE_NONE); // copy alpha as is
+            SDL_BlitSurface(rendered[g], NULL, sheet, &atlas.glyphs[g]);
+        }
+        atlas.texture = SDL_CreateTextureFromSurface(renderer, sheet);
+        SDL_FreeSurface(sheet);
+    }
+    for (int g = 0; g < ATLAS_GLYPHS; g++) SDL_FreeSurface(rendered[g]);
+    if (!atlas.texture) return 0;
+    SDL_SetTextureBlendMode(atlas.texture, SDL_BLENDMODE_BLEND);
+    return 1;
+}
+
+// Draw text from the glyph atlas as one batch of textured quads.
+// Handles '\n' and the UTF-8 degree sign.
 void drawText(const char* text, int x, int y, SDL_Color color) {
-    SDL_Surface* surface = TTF_RenderText_Solid(font, text, color);
-    SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
-    SDL_Rect rect = {x, y, surface->w, surface->h};
-    SDL_RenderCopy(renderer, texture, NULL, &rect);
-    SDL_FreeSurface(surface);
-    SDL_DestroyTexture(texture);
+    static SDL_Vertex vertices[MAX_TEXT_GLYPHS * 4];
+    static int indices[MAX_TEXT_GLYPHS * 6];
+    int n = 0;
+    float pen_x = x, pen_y = y;
+    for (const unsigned char* p = (const unsigned char*)text; ; p++) {
+        if (n == MAX_TEXT_GLYPHS || (*p == '\0' && n > 0)) {
+            SDL_RenderGeometry(renderer, atlas.texture, vertices, n * 4, indices, n * 6);
+            n = 0;
+        }
+        if (*p == '\0') break;
+        if (*p == '\n') {
+            pen_x = x;
+            pen_y += atlas.line_skip;
+            continue;
+        }
+        int g = '?' - 32;
+        if (*p >= 32 && *p < 127) {
+            g = *p - 32;
+        } else if (*p == 0xC2 && p[1] == 0xB0) {
+            g = GLYPH_DEGREE;
+            p++;
+        } else if (*p >= 0x80) {
+            while ((p[1] & 0xC0) == 0x80) p++; // skip the rest of the sequence
+        }
+        SDL_Rect r = atlas.glyphs[g];
+        if (r.w > 0) {
+            float u0 = (float)r.x / atlas.width, u1 = (float)(r.x + r.w) / atlas.width;
+            float v0 = (float)r.y / atlas.height, v1 = (float)(r.y + r.h) / atlas.height;
+            SDL_Vertex* v = &vertices[n * 4];
+            v[0] = (SDL_Vertex){{pen_x, pen_y}, color, {u0, v0}};
+            v[1] = (SDL_Vertex){{pen_x + r.w, pen_y}, color, {u1, v0}};
+            v[2] = (SDL_Vertex){{pen_x + r.w, pen_y + r.h}, color, {u1, v1}};
+            v[3] = (SDL_Vertex){{pen_x, pen_y + r.h}, color, {u0, v1}};
+            int* i = &indices[n * 6];
+            i[0] = n * 4; i[1] = n * 4 + 1; i[2] = n * 4 + 2;
+            i[3] = n * 4; i[4] = n * 4 + 2; i[5] = n * 4 + 3;
+            n++;
+        }
+        pen_x += atlas.advance[g];
+    }
+}
+
+// Size of text as drawText would draw it
+void measureText(const char* text, int* w, int* h) {
+    int line = 0;
+    *w = 0;
+    *h = atlas.line_skip;
+    for (const unsigned char* p = (const unsigned char*)text; *p; p++) {
+        if (*p == '\n') {
+            line = 0;
+            *h += atlas.line_skip;
+            continue;
+        }
+        int g = '?' - 32;
+        if (*p >= 32 && *p < 127) {
+            g = *p - 32;
+        } else if (*p == 0xC2 && p[1] == 0xB0) {
+            g = GLYPH_DEGREE;
+            p++;
+        } else if (*p >= 0x80) {
+            while ((p[1] & 0xC0) == 0x80) p++;
+        }
+        line += atlas.advance[g];
+        if (line > *w) *w = line;
+    }
+}
+
+// Draw a label that never changes from a texture built on first use
+void drawStaticText(const char* text, int x, int y, SDL_Color color) {
+    struct CachedText* entry = NULL;
+    for (int i = 0; i < text_cache_count; i++) {
+        struct CachedText* c = &text_cache[i];
+        if (c->color.r == color.r && c->color.g == color.g && c->color.b == color.b &&
+            c->color.a == color.a && (c->text == text || strcmp(c->text, text) == 0)) {
+            entry = c;
+            break;
+        }
+    }
+    if (!entry) {
+        if (text_cache_count == TEXT_CACHE_SIZE) {
+            drawText(text, x, y, color);
+            return;
+        }
+        SDL_Surface* surface = TTF_RenderUTF8_Blended_Wrapped(font, text, color, 0);
+        if (!surface) return;
+        entry = &text_cache[text_cache_count];
+        entry->texture = SDL_CreateTextureFromSurface(renderer, surface);
+        entry->w = surface->w;
+        entry->h = surface->h;
+        SDL_FreeSurface(surface);
+        if (!entry->texture) return;
+        entry->text = text;
+        entry->color = color;
+        text_cache_count++;
+    }
+    SDL_Rect rect = {x, y, entry->w, entry->h};
+    SDL_RenderCopy(renderer, entry->texture, NULL, &rect);
 }
 
 // Draw attitude indicator
@@ -195,75 +1286,55 @@ void drawAttitudeIndicator(int x, int y, int size) {
     SDL_RenderFillRect(renderer, &ground);
     SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
     SDL_RenderDrawLine(renderer, x - size/2, y, x + size/2, y); // Horizon
-    char label[20];
-    snprintf(label, 20, "Attitude");
-    drawText(label, x - 30, y + size/2 + 10, (SDL_Color){255, 255, 255, 255});
+    drawStaticText("Attitude", x - 30, y + size/2 + 10, (SDL_Color){255, 255, 255, 255});
 }
 
-// Draw airspeed indicator
-void drawAirspeedIndicator(int x, int y, int size) {
-    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-    for (int i = 0; i < 360; i += 10) {
-        float rad = i * PI / 180;
-        int x1 = x + (size/2 - 10) * cos(rad);
-        int y1 = y + (size/2 - 10) * sin(rad);
-        int x2 = x + size/2 * cos(rad);
-        int y2 = y + size/2 * sin(rad);
-        SDL_RenderDrawLine(renderer, x1, y1, x2, y2);
-    }
-    float angle = (plane.speed / perf.max_speed) * 2 * PI - PI/2;
-    int nx = x + (size/2 - 5) * cos(angle);
-    int ny = y + (size/2 - 5) * sin(angle);
-    SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
-    SDL_RenderDrawLine(renderer, x, y, nx, ny);
-    char speed[20];
-    snprintf(speed, 20, "%d kt", (int)plane.speed);
-    drawText(speed, x - 20, y - 10, (SDL_Color){0, 0, 0, 255});
-    drawText("Airspeed", x - 30, y + size/2 + 10, (SDL_Color){255, 255, 255, 255});
+// Current value and scale of a dial gauge
+void gaugeReading(int gauge, float* value, float* min, float* max) {
+    *min = 0;
+    switch (gauge + PANEL_AIRSPEED) {
+        case PANEL_AIRSPEED: *value = display.speed; *max = perf.max_speed; break;
+        case PANEL_ALTIMETER: *value = display.altitude; *max = perf.max_altitude; break;
+        case PANEL_HEADING: *value = display.heading; *max = 360; break;
+        case PANEL_VSI: *value = display.vertical_speed; *min = -6000; *max = 6000; break;
+        case PANEL_MACH: *value = display.mach_number; *max = 1; break;
+        default: *value = display.fuel; *max = perf.max_fuel; break;
+    }
 }
 
-// Draw altimeter
-void drawAltimeter(int x, int y, int size) {
-    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-    for (int i = 0; i < 360; i += 10) {
-        float rad = i * PI / 180;
-        int x1 = x + (size/2 - 10) * cos(rad);
-        int y1 = y + (size/2 - 10) * sin(rad);
-        int x2 = x + size/2 * cos(rad);
-        int y2 = y + size/2 * sin(rad);
-        SDL_RenderDrawLine(renderer, x1, y1, x2, y2);
-    }
-    float angle = (plane.altitude / perf.max_altitude) * 2 * PI - PI/2;
-    int nx = x + (size/2 - 5) * cos(angle);
-    int ny = y + (size/2 - 5) * sin(angle);
-    SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255);
-    SDL_RenderDrawLine(renderer, x, y, nx, ny);
-    char alt[20];
-    snprintf(alt, 20, "%d ft", (int)plane.altitude);
-    drawText(alt, x - 20, y - 10, (SDL_Color){0, 0, 0, 255});
-    drawText("Altitude", x - 30, y + size/2 + 10, (SDL_Color){255, 255, 255, 255});
+// Build tick marks for a dial of the given size, every 10 degrees along its arc
+void buildGaugeGeometry(struct Gauge* gauge, int size) {
+    int steps = (int)(gauge->sweep / (PI / 18) + 0.5f);
+    int full_turn = steps >= 36;
+    gauge->tick_count = full_turn ? 36 : steps + 1; // a full turn's last tick is its first
+    for (int i = 0; i < gauge->tick_count; i++) {
+        float rad = gauge->start + i * gauge->sweep / steps;
+        gauge->ticks[2 * i] = (SDL_Point){(int)((size/2 - 10) * cos(rad)), (int)((size/2 - 10) * sin(rad))};
+        gauge->ticks[2 * i + 1] = (SDL_Point){(int)(size/2 * cos(rad)), (int)(size/2 * sin(rad))};
+    }
+    gauge->built_size = size;
 }
 
-// Draw heading indicator
-void drawHeadingIndicator(int x, int y, int size) {
+// Draw a dial gauge: cached ticks, then the needle and readout for the current value
+void drawGauge(struct Gauge* gauge, int x, int y, int size, float value, float min, float max) {
+    if (gauge->built_size != size) buildGaugeGeometry(gauge, size);
     SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-    for (int i = 0; i < 360; i += 10) {
-        float rad = i * PI / 180;
-        int x1 = x + (size/2 - 10) * cos(rad);
-        int y1 = y + (size/2 - 10) * sin(rad);
-        int x2 = x + size/2 * cos(rad);
-        int y2 = y + size/2 * sin(rad);
-        SDL_RenderDrawLine(renderer, x1, y1, x2, y2);
-    }
-    float angle = plane.heading * PI / 180 - PI/2;
-    int nx = x + (size/2 - 5) * cos(angle);
-    int ny = y + (size/2 - 5) * sin(angle);
-    SDL_SetRenderDrawColor(renderer, 0, 0, 255, 255);
+    for (int i = 0; i < gauge->tick_count; i++) {
+        SDL_Point* t = &gauge->ticks[2 * i];
+        SDL_RenderDrawLine(renderer, x + t[0].x, y + t[0].y, x + t[1].x, y + t[1].y);
+    }
+    float fraction = (value - min) / (max - min);
+    if (gauge->sweep < 2 * PI) fraction = fminf(fmaxf(fraction, 0), 1); // partial dials stop at the pegs
+    float angle = gauge->start + fraction * gauge->sweep;
+    int nx = x + (size/2 - 5) * cosf(angle);
+    int ny = y + (size/2 - 5) * sinf(angle);
+    SDL_SetRenderDrawColor(renderer, gauge->needle.r, gauge->needle.g, gauge->needle.b, gauge->needle.a);
     SDL_RenderDrawLine(renderer, x, y, nx, ny);
-    char hdg[20];
-    snprintf(hdg, 20, "%d°", (int)plane.heading);
-    drawText(hdg, x - 20, y - 10, (SDL_Color){0, 0, 0, 255});
-    drawText("Heading", x - 30, y + size/2 + 10, (SDL_Color){255, 255, 255, 255});
+    char readout[24];
+    if (gauge->decimals) snprintf(readout, sizeof(readout), "%.*f%s", gauge->decimals, value, gauge->unit);
+    else snprintf(readout, sizeof(readout), "%d%s", (int)value, gauge->unit);
+    drawText(readout, x - 20, y - 10, (SDL_Color){0, 0, 0, 255});
+    drawStaticText(gauge->label, x - 30, y + size/2 + 10, (SDL_Color){255, 255, 255, 255});
 }
 
 // Draw navigation map
@@ -272,35 +1343,50 @@ void drawMap(int x, int y, int size) {
     SDL_Rect map = {x - size/2, y - size/2, size, size};
     SDL_RenderFillRect(renderer, &map);
     float scale = size / 30.0; // 30 degrees lat/lon
-    for (int i = 0; i < MAX_AIRPORTS; i++) {
-        float px = x + (airports[i].lon - plane.lon) * scale;
-        float py = y - (airports[i].lat - plane.lat) * scale;
+    static int* visible; // room for every airport, grown as more are loaded
+    static int visible_capacity;
+    if (visible_capacity < airport_count) {
+        int* grown = realloc(visible, airport_count * sizeof(int));
+        if (grown) {
+            visible = grown;
+            visible_capacity = airport_count;
+        }
+    }
+    float half = size / 2 / scale;
+    float lon_min = display.lon - half, lon_max = display.lon + half;
+    if (lon_min < -180) lon_min += 360;
+    if (lon_max >= 180) lon_max -= 360;
+    int count = airportsInRect(display.lat - half, display.lat + half, lon_min, lon_max, visible, visible_capacity);
+    for (int v = 0; v < count; v++) {
+        int i = visible[v];
+        float px = x + (airports[i].lon - display.lon) * scale;
+        float py = y - (airports[i].lat - display.lat) * scale;
         if (px > x - size/2 && px < x + size/2 && py > y - size/2 && py < y + size/2) {
             SDL_SetRenderDrawColor(renderer, 255, 255, 0, 255);
             SDL_Rect dot = {(int)px - 2, (int)py - 2, 4, 4};
             SDL_RenderFillRect(renderer, &dot);
-            drawText(airports[i].code, (int)px - 10, (int)py + 5, (SDL_Color){255, 255, 255, 255});
+            drawStaticText(airports[i].code, (int)px - 10, (int)py + 5, (SDL_Color){255, 255, 255, 255});
         }
     }
+    SDL_SetRenderDrawColor(renderer, 255, 0, 255, 255);
+    for (int i = 0; i < flight_plan.leg_count; i++) { // flight plan, clipped to the map
+        const struct FlightLeg* leg = &flight_plan.legs[i];
+        const struct Airport* fix = &airports[leg->fix];
+        float end_lat = i + 1 < flight_plan.leg_count ? leg[1].lat : fix->lat;
+        float end_lon = i + 1 < flight_plan.leg_count ? leg[1].lon : fix->lon;
+        int x1 = x + (leg->lon - display.lon) * scale, y1 = y - (leg->lat - display.lat) * scale;
+        int x2 = x + (end_lon - display.lon) * scale, y2 = y - (end_lat - display.lat) * scale;
+        if (SDL_IntersectRectAndLine(&map, &x1, &y1, &x2, &y2)) SDL_RenderDrawLine(renderer, x1, y1, x2, y2);
+    }
     SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
     SDL_Point plane_shape[] = {{x, y - 10}, {x - 5, y + 5}, {x + 5, y + 5}};
     SDL_RenderDrawLines(renderer, plane_shape, 3);
-    drawText("Nav Map", x - 30, y + size/2 + 10, (SDL_Color){255, 255, 255, 255});
+    drawStaticText("Nav Map", x - 30, y + size/2 + 10, (SDL_Color){255, 255, 255, 255});
 }
 
-// Render cockpit
-void renderCockpit(void) {
-    SDL_SetRenderDrawColor(renderer, 50, 50, 50, 255);
-    SDL_RenderClear(renderer);
-    
-    drawAttitudeIndicator(100, 100, 150);
-    drawAirspeedIndicator(300, 100, 100);
-    drawAltimeter(500, 100, 100);
-    drawHeadingIndicator(300, 300, 100);
-    drawMap(600, 400, 150);
-    
-    char info[512];
-    snprintf(info, 512,
+// Format the flight information panel
+static void formatCockpitInfo(char* info, size_t size) {
+    snprintf(info, size,
         "Aircraft Performance Monitor\n"
         "Time: %d s\n"
         "Phase: %s\n"
@@ -318,127 +1404,494 @@ void renderCockpit(void) {
         "Autopilot: %s\n"
         "Transponder: %s\n"
         "\nWeather:\n"
-        "Wind: %.0f kt from %.0f°\n"
+        "Wind: %.0f kt toward %.0f°\n"
         "Temperature: %.1f°C\n"
         "Pressure: %.1f hPa",
-        flight_time, getPhaseName(plane.phase),
-        plane.altitude, plane.speed, plane.ground_speed,
-        plane.heading, plane.bank_angle, plane.vertical_speed,
-        plane.fuel, plane.distance_remaining,
-        plane.flaps, plane.gear ? "DOWN" : "UP",
-        plane.autopilot ? "ON" : "OFF", plane.transponder ? "ON" : "OFF",
+        flight_time, getPhaseName(display.phase),
+        display.altitude, display.speed, display.ground_speed,
+        display.heading, display.bank_angle, display.vertical_speed,
+        display.fuel, display.distance_remaining,
+        display.flaps, display.gear ? "DOWN" : "UP",
+        display.autopilot ? "ON" : "OFF", display.transponder ? "ON" : "OFF",
         current_weather.wind_speed, current_weather.wind_direction,
         current_weather.temperature, current_weather.pressure);
-    drawText(info, 10, 10, (SDL_Color){255, 255, 255, 255});
-    
-    drawText("Controls:\nT: Throttle\nB: Bank Angle\nF: Flaps\nG: Gear\nA: Autopilot\nX: Transponder\nQ: Quit",
-             10, 400, (SDL_Color){255, 255, 255, 255});
-    
-    SDL_RenderPresent(renderer);
+    if (control_entry.control >= 0) {
+        size_t used = strlen(info);
+        snprintf(info + used, size - used, "\n\n%s%s_", control_prompts[control_entry.control], control_entry.text);
+    }
+}
+
+// Screen area of a panel, labels and overhanging text included
+static SDL_Rect panelBounds(int id) {
+    int x = panel_layout[id][0], y = panel_layout[id][1], size = panel_layout[id][2];
+    int w, h;
+    if (id == PANEL_INFO || id == PANEL_CONTROLS) {
+        measureText(id == PANEL_INFO ? cockpit.info : controls_text, &w, &h);
+        return (SDL_Rect){x, y, w + 2, h + 2};
+    }
+    SDL_Rect bounds = {x - size/2 - 1, y - size/2 - 1, size + 3, size + 3};
+    int gauge = id - PANEL_AIRSPEED;
+    int is_gauge = gauge >= 0 && gauge < NUM_GAUGES;
+    measureText(is_gauge ? gauges[gauge].label : "Attitude", &w, &h);
+    SDL_Rect label = {x - 30, y + size/2 + 10, w, h};
+    SDL_UnionRect(&bounds, &label, &bounds);
+    if (is_gauge) {
+        char widest[24];
+        snprintf(widest, sizeof(widest), "-00000%s", gauges[gauge].unit);
+        measureText(widest, &w, &h);
+        SDL_Rect readout = {x - 20, y - 10, w, h};
+        SDL_UnionRect(&bounds, &readout, &bounds);
+    }
+    if (id == PANEL_MAP) {
+        measureText("WWW", &w, &h); // airport codes drawn past the map edge
+        SDL_Rect codes = {x - size/2 - 10, y - size/2 + 3, size + 10 + w, size + h};
+        SDL_UnionRect(&bounds, &codes, &bounds);
+    }
+    return bounds;
+}
+
+// Simulation state each panel is drawn from
+static void panelInputs(int id, float* in) {
+    int gauge = id - PANEL_AIRSPEED;
+    if (gauge >= 0 && gauge < NUM_GAUGES) {
+        gaugeReading(gauge, &in[0], &in[1], &in[2]);
+    } else if (id == PANEL_MAP) {
+        in[0] = display.lat;
+        in[1] = display.lon;
+    } // attitude and controls are static, the info panel compares its text
+}
+
+// Draw one panel at its place in the scene
+static void drawPanel(int id) {
+    int x = panel_layout[id][0], y = panel_layout[id][1], size = panel_layout[id][2];
+    SDL_Color white = {255, 255, 255, 255};
+    int gauge = id - PANEL_AIRSPEED;
+    if (gauge >= 0 && gauge < NUM_GAUGES) {
+        float value, min, max;
+        gaugeReading(gauge, &value, &min, &max);
+        PROFILE(STAGE_DRAW_GAUGE, drawGauge(&gauges[gauge], x, y, size, value, min, max));
+        return;
+    }
+    switch (id) {
+        case PANEL_ATTITUDE: PROFILE(STAGE_DRAW_ATTITUDE, drawAttitudeIndicator(x, y, size)); break;
+        case PANEL_MAP: PROFILE(STAGE_DRAW_MAP, drawMap(x, y, size)); break;
+        case PANEL_INFO: PROFILE(STAGE_DRAW_TEXT, drawText(cockpit.info, x, y, white)); break;
+        case PANEL_CONTROLS: PROFILE(STAGE_DRAW_STATIC_TEXT, drawStaticText(controls_text, x, y, white)); break;
+    }
+}
+
+// Create the retained scene texture; without render targets every change redraws the window
+void initCockpit(void) {
+    SDL_GetRendererOutputSize(renderer, &cockpit.width, &cockpit.height);
+    if (SDL_RenderTargetSupported(renderer)) {
+        cockpit.scene = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET,
+                                          cockpit.width, cockpit.height);
+    }
+    if (!cockpit.scene) printf("Render targets unavailable, redrawing the whole cockpit on change\n");
+    invalidateCockpit(1);
+}
+
+// Request a recomposite, and with content a full repaint of every panel
+void invalidateCockpit(int content) {
+    cockpit.present = 1;
+    if (!content) return;
+    cockpit.repaint = 1;
+    for (int id = 0; id < NUM_PANELS; id++) cockpit.panels[id].valid = 0;
+    cockpit.info[0] = '\0';
+}
+
+// Render cockpit: repaint only the panels whose inputs changed into the
+// retained scene, then present. Frames where nothing changed cost nothing.
+void renderCockpit(void) {
+    SDL_Rect dirty[NUM_PANELS + 1];
+    int n = 0;
+    char info[512];
+    formatCockpitInfo(info, sizeof(info));
+    for (int id = 0; id < NUM_PANELS; id++) {
+        struct CockpitPanel* panel = &cockpit.panels[id];
+        float in[PANEL_INPUTS] = {0};
+        panelInputs(id, in);
+        int changed = !panel->valid || memcmp(in, panel->inputs, sizeof(in)) != 0;
+        if (id == PANEL_INFO && strcmp(info, cockpit.info) != 0) {
+            if (panel->valid) dirty[n++] = panel->bounds; // erase the old text
+            strcpy(cockpit.info, info);
+            changed = 1;
+        }
+        if (!changed) continue;
+        if (!panel->valid || id == PANEL_INFO) panel->bounds = panelBounds(id);
+        memcpy(panel->inputs, in, sizeof(in));
+        panel->valid = 1;
+        dirty[n++] = panel->bounds;
+    }
+    if (n == 0 && !cockpit.present) return;
+
+    if (cockpit.scene) SDL_SetRenderTarget(renderer, cockpit.scene);
+    if (!cockpit.scene || cockpit.repaint) {
+        n = 1; // back buffer contents are undefined after a present
+        dirty[0] = (SDL_Rect){0, 0, cockpit.width, cockpit.height};
+        cockpit.repaint = 0;
+    }
+    for (int i = 0; i < n; i++) {
+        SDL_RenderSetClipRect(renderer, &dirty[i]);
+        SDL_SetRenderDrawColor(renderer, 50, 50, 50, 255);
+        SDL_RenderFillRect(renderer, &dirty[i]);
+        for (int id = 0; id < NUM_PANELS; id++) {
+            if (SDL_HasIntersection(&cockpit.panels[id].bounds, &dirty[i])) drawPanel(id);
+        }
+    }
+    SDL_RenderSetClipRect(renderer, NULL);
+    if (cockpit.scene) {
+        SDL_SetRenderTarget(renderer, NULL);
+        SDL_RenderCopy(renderer, cockpit.scene, NULL, NULL);
+    }
+    PROFILE(STAGE_PRESENT, SDL_RenderPresent(renderer));
+    cockpit.present = 0;
+}
+
+// Get performance data for an aircraft type
+struct AircraftPerformance getAircraftPerformance(AircraftType type) {
+    struct AircraftPerformance p = {0};
+    if (type >= 0 && type < aircraft_type_count) p = aircraft_profiles[type].perf;
+    return p;
+}
+
+// Append an aircraft profile, interning its strings; returns its type or -1
+int addAircraftProfile(const struct AircraftProfile* profile) {
+    if (aircraft_type_count == aircraft_capacity) {
+        int capacity = aircraft_capacity ? aircraft_capacity * 2 : 16;
+        struct AircraftProfile* grown = realloc(aircraft_profiles, capacity * sizeof(struct AircraftProfile));
+        if (!grown) return -1;
+        aircraft_profiles = grown;
+        aircraft_capacity = capacity;
+    }
+    struct AircraftProfile* added = &aircraft_profiles[aircraft_type_count];
+    *added = *profile;
+    added->code = internString(profile->code);
+    added->name = internString(profile->name);
+    if (!added->code || !added->name) return -1;
+    return aircraft_type_count++;
+}
+
+// Aircraft type with the given code, or -1
+int findAircraftType(const char* code) {
+    for (int t = 0; t < aircraft_type_count; t++) {
+        if (strcmp(aircraft_profiles[t].code, code) == 0) return t;
+    }
+    return -1;
+}
+
+// Aircraft type from a command line argument: a code or a type number
+int parseAircraftType(const char* text) {
+    int type = findAircraftType(text);
+    if (type >= 0) return type;
+    char* end;
+    long number = strtol(text, &end, 10);
+    return end != text && *end == '\0' && number >= 0 && number < aircraft_type_count ? (int)number : -1;
+}
+
+// Load the built-in aircraft
+int initAircraftProfiles(void) {
+    for (int t = 0; t < NUM_AIRCRAFT_TYPES; t++) {
+        if (addAircraftProfile(&builtin_aircraft[t]) < 0) return 0;
+    }
+    return 1;
+}
+
+// Load aircraft types and per-tail variants from a CSV file, one per line:
+//   code,name,base[,max_speed,max_altitude,...,min_runway]
+// with the performance fields in PERF_FIELDS order. Empty or missing
+// fields are copied from the base type, which must already be known; a
+// profile without a base gives every field. Blank lines and lines starting
+// with # are skipped, codes already known are ignored (the built-ins
+// cannot be redefined, their fleet kernels are compiled for them).
+int loadAircraftProfiles(const char* path) {
+    static const size_t offsets[] = {
+#define X(field) offsetof(struct AircraftPerformance, field),
+        PERF_FIELDS(X)
+#undef X
+    };
+    const int perf_fields = sizeof(offsets) / sizeof(offsets[0]);
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        printf("ERROR: Could not open %s!\n", path);
+        return 0;
+    }
+    char line[512];
+    int line_number = 0, loaded = 0;
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+        char* fields[MAX_CSV_FIELDS] = {0};
+        int n = 0;
+        for (char* field = line; field && n < MAX_CSV_FIELDS; n++) {
+            fields[n] = field;
+            field = strchr(field, ',');
+            if (field) *field++ = '\0';
+        }
+        int base = n >= 3 ? findAircraftType(fields[2]) : -1;
+        if (n < 3 || fields[0][0] == '\0' || (fields[2][0] != '\0' && base < 0) ||
+            (base < 0 && n < 3 + perf_fields)) {
+            printf("ERROR: %s:%d is not code,name,base,... with a known base or every field!\n",
+                   path, line_number);
+            fclose(file);
+            return 0;
+        }
+        struct AircraftProfile profile = {0};
+        profile.code = fields[0];
+        profile.name = fields[1];
+        if (base >= 0) profile.perf = aircraft_profiles[base].perf;
+        for (int f = 0; f < perf_fields && 3 + f < n; f++) {
+            char* end;
+            float value = strtof(fields[3 + f], &end);
+            if (end != fields[3 + f]) *(float*)((char*)&profile.perf + offsets[f]) = value;
+        }
+        if (findAircraftType(profile.code) >= 0) continue;
+        if (addAircraftProfile(&profile) < 0) {
+            printf("ERROR: Out of memory loading %s!\n", path);
+            fclose(file);
+            return 0;
+        }
+        loaded++;
+    }
+    fclose(file);
+    printf("Loaded %d aircraft types from %s (%d total)\n", loaded, path, aircraft_type_count);
+    return 1;
 }
 
 // Initialize aircraft performance
 void initAircraftPerformance(AircraftType type) {
-    switch(type) {
-        case AIRCRAFT_CESSNA:
-            perf.max_speed = 160; perf.max_altitude = 14000; perf.max_fuel = 56;
-            perf.empty_weight = 1670; perf.max_weight = 2550; perf.max_thrust = 230;
-            perf.fuel_flow = 10; perf.stall_speed = 47; perf.vne = 163;
-            perf.vno = 126; perf.vfe = 85;
-            break;
-        case AIRCRAFT_BOEING737:
-            perf.max_speed = 350; perf.max_altitude = 41000; perf.max_fuel = 6875;
-            perf.empty_weight = 91000; perf.max_weight = 174200; perf.max_thrust = 27000;
-            perf.fuel_flow = 2500; perf.stall_speed = 108; perf.vne = 350;
-            perf.vno = 280; perf.vfe = 230;
-            break;
-        case AIRCRAFT_AIRBUS320:
-            perf.max_speed = 350; perf.max_altitude = 39800; perf.max_fuel = 6875;
-            perf.empty_weight = 93000; perf.max_weight = 170000; perf.max_thrust = 27000;
-            perf.fuel_flow = 2500; perf.stall_speed = 108; perf.vne = 350;
-            perf.vno = 280; perf.vfe = 230;
-            break;
+    perf = getAircraftPerformance(type);
+}
+
+// Exact standard atmosphere at an altitude (ft): temperature ratio theta and
+// pressure ratio delta, troposphere lapse then isothermal stratosphere
+static void isaExact(double altitude, double* theta, double* delta) {
+    if (altitude <= ISA_TROPOPAUSE) {
+        *theta = 1 - 6.87559e-6 * altitude;
+        *delta = pow(*theta, 5.25588);
+    } else {
+        *theta = 1 - 6.87559e-6 * ISA_TROPOPAUSE;
+        *delta = pow(*theta, 5.25588) * exp(-(altitude - ISA_TROPOPAUSE) / 20805.8);
+    }
+}
+
+// Tabulate the standard atmosphere, once at startup
+void initAtmosphere(void) {
+    for (int i = 0; i <= ISA_ROWS; i++) {
+        double theta, delta;
+        isaExact(ISA_FLOOR + (i < ISA_ROWS ? i : ISA_ROWS - 1) * ISA_STEP, &theta, &delta);
+        isa.density_ratio[i] = delta / theta;
+        isa.density_sqrt[i] = sqrt(delta / theta);
+        isa.pressure[i] = 1013.25 * delta;
+        isa.temperature[i] = 288.15 * theta - 273.15;
+        isa.sound_speed[i] = 661.47 * sqrt(theta);
     }
 }
 
+// Interpolate one standard atmosphere column at an altitude (ft)
+static inline float isaLookup(const float* column, float altitude) {
+    float x = fminf(fmaxf((altitude - ISA_FLOOR) * (1 / ISA_STEP), 0.0f), ISA_ROWS - 1);
+    int i = (int)x;
+    return column[i] + (column[i + 1] - column[i]) * (x - i);
+}
+
 // Calculate aerodynamics
 void calculateAerodynamics(void) {
-    float density_ratio = pow((288.15 - 0.0065 * plane.altitude) / 288.15, 4.256);
-    float q = 0.5 * 0.002377 * density_ratio * pow(plane.true_airspeed * 1.68781, 2);
+    float density_ratio = isaLookup(isa.density_ratio, plane.altitude);
+    float v = plane.true_airspeed * 1.68781; // ft/s
+    float q = 0.5 * 0.002377 * density_ratio * v * v;
     float cl = 1.0;
     float wing_area = 174.0;
     float lift = q * cl * wing_area;
-    float cd = 0.02 + 0.1 * pow(cl, 2);
+    float cd = 0.02 + 0.1 * cl * cl;
     float drag = q * cd * wing_area;
     plane.g_force = lift / (perf.empty_weight * GRAVITY);
     plane.density_altitude = plane.altitude + (1013.25 - plane.pressure) * 30;
 }
 
-// Update weather
-void updateWeather(void) {
-    current_weather.wind_speed += (rand() % 3 - 1) * 0.5;
-    current_weather.wind_direction += (rand() % 3 - 1) * 5.0;
-    current_weather.temperature -= 0.0065 * 100;
-    current_weather.pressure = 1013.25 * pow((288.15 - 0.0065 * 100) / 288.15, 5.256);
+// Arena index of a weather tile, loading it on a miss. The index answers
+// almost every lookup without searching the set.
+static inline int weatherTile(struct WeatherGrid* grid, struct WeatherCache* cache, int key) {
+    int slot = cache->index[key & (WEATHER_INDEX - 1)];
+    if (cache->key[slot] != key) {
+        int first = key % WEATHER_SETS * WEATHER_WAYS;
+        for (slot = first; slot < first + WEATHER_WAYS && cache->key[slot] != key; slot++) {}
+        if (slot == first + WEATHER_WAYS) slot = weatherLoad(grid, cache, key);
+        cache->index[key & (WEATHER_INDEX - 1)] = (unsigned char)slot;
+    }
+    cache->used[slot] = ++cache->clock;
+    return slot * grid->tile_floats;
+}
+
+// Fractional index of a coordinate along one weather grid axis, clamped
+// to the grid
+static inline float weatherAxis(float value, float origin, float scale, int count) {
+    float x = (value - origin) * scale;
+    return x > 0 ? (x < count - 1 ? x : count - 1) : 0; // not fminf(): a libm call, and NaN goes to 0
+}
+
+// Find the weather grid cell around a position and flight time (s): the
+// arena index of its low corner in the slices before and after the time,
+// and the weights toward the high corner along lon, lat, level and time
+static inline void weatherLocate(struct WeatherGrid* grid, struct WeatherCache* cache, float lat, float lon,
+                                 float altitude, float time, int* corner, float* weight) {
+    const struct WeatherHeader* h = &grid->header;
+    float y = weatherAxis(lat, h->lat0, grid->lat_scale, h->lat_count);
+    float x = weatherAxis(lon, h->lon0, grid->lon_scale, h->lon_count);
+    float z = weatherAxis(altitude, h->level0, grid->level_scale, h->level_count);
+    float t = weatherAxis(time, 0, grid->time_scale, h->time_count);
+    int row = (int)y < h->lat_count - 2 ? (int)y : h->lat_count - 2;
+    int col = (int)x < h->lon_count - 2 ? (int)x : h->lon_count - 2;
+    int level = (int)z < h->level_count - 2 ? (int)z : h->level_count - 2;
+    int slice = (int)t < h->time_count - 2 ? (int)t : h->time_count > 1 ? h->time_count - 2 : 0;
+    int tiles = grid->tiles_lat * grid->tiles_lon;
+    int tile = row / WEATHER_TILE * grid->tiles_lon + col / WEATHER_TILE;
+    int offset = (level * WEATHER_POINTS + row % WEATHER_TILE) * WEATHER_ROW + col % WEATHER_TILE * WEATHER_FIELDS;
+    corner[0] = weatherTile(grid, cache, slice * tiles + tile) + offset;
+    corner[1] = weatherTile(grid, cache, (slice + (h->time_count > 1)) * tiles + tile) + offset;
+    weight[0] = x - col;
+    weight[1] = y - row;
+    weight[2] = z - level;
+    weight[3] = t - slice;
 }
 
-// Calculate wind effect
-void calculateWindEffect(void) {
-    float wind_x = current_weather.wind_speed * sin(current_weather.wind_direction * PI / 180.0);
-    float wind_y = current_weather.wind_speed * cos(current_weather.wind_direction * PI / 180.0);
+// Trilinear blend of one weather field over the cell with its low corner at p
+static inline float weatherBlend(const float* p, const float* weight) {
+    float c00 = p[0] + (p[WEATHER_FIELDS] - p[0]) * weight[0];
+    float c01 = p[WEATHER_ROW] + (p[WEATHER_ROW + WEATHER_FIELDS] - p[WEATHER_ROW]) * weight[0];
+    float c10 = p[WEATHER_LEVEL] + (p[WEATHER_LEVEL + WEATHER_FIELDS] - p[WEATHER_LEVEL]) * weight[0];
+    float c11 = p[WEATHER_LEVEL + WEATHER_ROW] +
+                (p[WEATHER_LEVEL + WEATHER_ROW + WEATHER_FIELDS] - p[WEATHER_LEVEL + WEATHER_ROW]) * weight[0];
+    float c0 = c00 + (c01 - c00) * weight[1];
+    float c1 = c10 + (c11 - c10) * weight[1];
+    return c0 + (c1 - c0) * weight[2];
+}
+
+// Update weather: wind random walk, scaled by sqrt(dt) so its spread per
+// second does not depend on the step size, and the standard lapse rate from
+// the surface temperature. A weather grid replaces both, sampled in
+// calculateWindEffect().
+void updateWeather(float dt, unsigned int step) {
+    if (!weather_grid) {
+        current_weather.wind_speed += (int)(rngCounter(sim_seed, 0, step * 2) % 3 - 1) * 0.5 * sqrt(dt);
+        current_weather.wind_direction += (int)(rngCounter(sim_seed, 0, step * 2 + 1) % 3 - 1) * 5.0 * sqrt(dt);
+        current_weather.temperature = isaLookup(isa.temperature, plane.altitude) + plane.temperature - 15.0f;
+    }
+    current_weather.pressure = isaLookup(isa.pressure, 328.08f); // 100 m
+}
+
+// Calculate wind effect. With a weather grid the wind and temperature are
+// sampled at the aircraft's position and flight time (s).
+void calculateWindEffect(float time) {
+    float wind_x, wind_y;
+    if (weather_grid) {
+        float sample[WEATHER_FIELDS];
+        weatherSample(0, plane.lat, plane.lon, plane.altitude, time, sample);
+        wind_x = sample[0];
+        wind_y = sample[1];
+        current_weather.wind_speed = sqrt(wind_x * wind_x + wind_y * wind_y);
+        current_weather.wind_direction = fmod(atan2(wind_x, wind_y) * 180.0 / PI + 360.0, 360.0);
+        current_weather.temperature = sample[2];
+    } else {
+        wind_x = current_weather.wind_speed * sin(current_weather.wind_direction * PI / 180.0);
+        wind_y = current_weather.wind_speed * cos(current_weather.wind_direction * PI / 180.0);
+    }
     float aircraft_x = plane.speed * sin(plane.heading * PI / 180.0);
     float aircraft_y = plane.speed * cos(plane.heading * PI / 180.0);
     float ground_x = aircraft_x + wind_x;
     float ground_y = aircraft_y + wind_y;
     plane.ground_speed = sqrt(ground_x * ground_x + ground_y * ground_y);
     plane.true_airspeed = plane.speed;
-    plane.indicated_airspeed = plane.true_airspeed * sqrt(current_weather.pressure / 1013.25);
-    plane.mach_number = plane.true_airspeed / 661.0;
+    plane.indicated_airspeed = plane.true_airspeed * isaLookup(isa.density_sqrt, plane.altitude);
+    plane.mach_number = plane.true_airspeed / isaLookup(isa.sound_speed, plane.altitude);
+}
+
+// Along- and cross-track position relative to a leg, from a local flat
+// projection at the leg start. Used once per leg when it becomes active.
+static void legOffset(const struct FlightLeg* leg, float lat, float lon, float* along, float* cross) {
+    float dlon = lon - leg->lon;
+    if (dlon > 180) dlon -= 360;
+    else if (dlon < -180) dlon += 360;
+    float north = (lat - leg->lat) * 60;
+    float east = dlon * 60 * cos((lat + leg->lat) / 2 * PI / 180.0);
+    *along = north * leg->course_cos + east * leg->course_sin;
+    *cross = east * leg->course_cos - north * leg->course_sin;
+}
+
+// New heading to capture and hold a leg: intercept angle proportional to
+// the cross-track error, turning at no more than TURN_RATE
+static float legSteer(const struct FlightLeg* leg, float cross, float heading, float dt) {
+    float intercept = fmaxf(fminf(cross * INTERCEPT_GAIN, MAX_INTERCEPT), -MAX_INTERCEPT);
+    float turn = fmodf(leg->course - intercept - heading, 360.0f);
+    if (turn > 180) turn -= 360;
+    else if (turn < -180) turn += 360;
+    turn = fmaxf(fminf(turn, TURN_RATE * dt), -TURN_RATE * dt);
+    heading = fmodf(heading + turn, 360.0f);
+    return heading < 0 ? heading + 360 : heading;
 }
 
 // Update navigation
-void updateNavigation(void) {
+void updateNavigation(float dt) {
     float lat_rad = plane.lat * PI / 180.0;
     float lon_rad = plane.lon * PI / 180.0;
-    float distance_nm = plane.ground_speed / 3600.0;
+    float distance_nm = plane.ground_speed * dt / 3600.0;
     float heading_rad = plane.heading * PI / 180.0;
     plane.lat += (distance_nm * cos(heading_rad)) / 60.0;
     plane.lon += (distance_nm * sin(heading_rad)) / (60.0 * cos(lat_rad));
+    if (flight_plan.leg_count == 0) return;
+
+    // Track the active leg from this step's displacement, sequence and steer
+    const struct FlightLeg* leg = &flight_plan.legs[plane.leg];
+    plane.along_track += distance_nm * (cos(heading_rad) * leg->course_cos + sin(heading_rad) * leg->course_sin);
+    plane.cross_track += distance_nm * (sin(heading_rad) * leg->course_cos - cos(heading_rad) * leg->course_sin);
+    while (plane.along_track >= leg->length && plane.leg < flight_plan.leg_count - 1) {
+        leg = &flight_plan.legs[++plane.leg];
+        legOffset(leg, plane.lat, plane.lon, &plane.along_track, &plane.cross_track);
+    }
+    plane.distance_remaining = leg->remaining + leg->length - plane.along_track;
+    if (plane.phase >= 2) plane.heading = legSteer(leg, plane.cross_track, plane.heading, dt);
 }
 
 // Check flight envelope
 void checkFlightEnvelope(void) {
     if (plane.speed > perf.vne) {
-        printf("WARNING: Exceeding VNE!\n");
+        flightWarning("Exceeding VNE!");
         plane.speed = perf.vne;
     }
     if (plane.speed < perf.stall_speed) {
-        printf("WARNING: Below stall speed!\n");
+        flightWarning("Below stall speed!");
         plane.speed = perf.stall_speed;
     }
     if (plane.altitude > perf.max_altitude) {
-        printf("WARNING: Exceeding maximum altitude!\n");
+        flightWarning("Exceeding maximum altitude!");
         plane.altitude = perf.max_altitude;
     }
     if (plane.altitude < MIN_ALTITUDE) {
-        printf("WARNING: Below minimum altitude!\n");
+        flightWarning("Below minimum altitude!");
         plane.altitude = MIN_ALTITUDE;
     }
     if (plane.g_force > 2.5) {
-        printf("WARNING: High G-force!\n");
+        flightWarning("High G-force!");
     }
 }
 
+// Report an envelope warning
+void flightWarning(const char* message) {
+    warning_count++;
+    if (!quiet) printf("WARNING: %s\n", message);
+}
+
 // Update instruments
-void updateInstruments(void) {
-    plane.vertical_speed = (plane.altitude - plane.prev_altitude) * 60.0;
+void updateInstruments(float dt) {
+    plane.vertical_speed = (plane.altitude - plane.prev_altitude) / dt * 60.0;
     plane.prev_altitude = plane.altitude;
 }
 
 // Initialize flight
 void initFlight(void) {
-    float distance = calculateDistance(airports[dep_idx].lat, airports[dep_idx].lon,
-                                      airports[dest_idx].lat, airports[dest_idx].lon);
+    buildFlightPlan(&flight_plan, dep_idx, route_via, route_via_count, dest_idx);
+    float distance = flight_plan.total;
     plane.distance_remaining = distance;
     plane.altitude = airports[dep_idx].elevation;
     plane.prev_altitude = plane.altitude;
@@ -458,199 +1911,4417 @@ void initFlight(void) {
     plane.temperature = current_weather.temperature;
     plane.pressure = current_weather.pressure;
     plane.type = AIRCRAFT_BOEING737;
+    plane.leg = 0;
+    plane.along_track = 0;
+    plane.cross_track = 0;
+}
+
+// Fraction of the gap a first-order lag with the given per-second factor
+// closes in dt seconds (exactly that factor at dt = 1)
+static inline double lagFactor(double per_second, float dt) {
+    return dt == 1.0f ? per_second : 1.0 - pow(1.0 - per_second, dt);
 }
 
-// Update flight
-void updateFlight(void) {
-    switch (plane.phase) {
+// Phase logic shared by updateFlight() and fleetUpdateFlight(): one
+// aircraft's speed, altitude, fuel and configuration over dt seconds.
+// speed_lag and altitude_lag are lagFactor(0.05, dt) and lagFactor(0.1, dt).
+static inline void flightPhaseStep(float* speed, float* altitude, float* fuel, int* phase, int* flaps, int* gear,
+                                   float throttle, float distance, float dt, double speed_lag, double altitude_lag) {
+    switch (*phase) {
         case 0: // Ground
-            if (plane.speed > 0) plane.speed -= 1.0;
+            if (*speed > 0) *speed -= 1.0 * dt;
             break;
         case 1: // Takeoff
-            plane.speed += plane.throttle * 10.0;
-            plane.fuel -= plane.throttle * 0.3;
-            if (plane.speed > 120) {
-                plane.phase = 2;
-                plane.altitude += 50;
-                plane.gear = 0;
+            *speed += throttle * 10.0 * dt;
+            *fuel -= throttle * 0.3 * dt;
+            if (*speed > 120) {
+                *phase = 2;
+                *altitude += 50;
+                *gear = 0;
             }
             break;
         case 2: // Climb
-            plane.speed += plane.throttle * 2.0 - 0.5;
-            plane.altitude += plane.speed * 0.5;
-            plane.fuel -= plane.throttle * 0.2;
-            plane.distance_remaining -= plane.speed / 3600.0;
-            if (plane.altitude >= 30000) {
-                plane.phase = 3;
-                plane.flaps = 0;
+            *speed += (throttle * 2.0 - 0.5) * dt;
+            *altitude += *speed * 0.5 * dt;
+            *fuel -= throttle * 0.2 * dt;
+            if (*altitude >= 30000) {
+                *phase = 3;
+                *flaps = 0;
             }
             break;
         case 3: // Cruise
-            plane.speed += (plane.throttle * 400 - plane.speed) * 0.05;
-            plane.altitude += (30000 - plane.altitude) * 0.1;
-            plane.fuel -= plane.throttle * 0.15;
-            plane.distance_remaining -= plane.speed / 3600.0;
-            if (plane.distance_remaining < 100) {
-                plane.phase = 4;
-                plane.flaps = 10;
+            *speed += (throttle * 400 - *speed) * speed_lag;
+            *altitude += (30000 - *altitude) * altitude_lag;
+            *fuel -= throttle * 0.15 * dt;
+            if (distance < DESCENT_DISTANCE) {
+                *phase = 4;
+                *flaps = 10;
             }
             break;
         case 4: // Descent
-            plane.speed += (plane.throttle * 300 - plane.speed) * 0.05;
-            plane.altitude -= plane.speed * 0.4;
-            plane.fuel -= plane.throttle * 0.1;
-            plane.distance_remaining -= plane.speed / 3600.0;
-            if (plane.altitude <= 5000) {
-                plane.phase = 5;
-                plane.flaps = 20;
-                plane.gear = 1;
+            *speed += (throttle * 300 - *speed) * speed_lag;
+            *altitude -= *speed * 0.4 * dt;
+            *fuel -= throttle * 0.1 * dt;
+            if (*altitude <= 5000) {
+                *phase = 5;
+                *flaps = 20;
+                *gear = 1;
             }
             break;
         case 5: // Landing
-            plane.speed -= 5.0;
-            plane.altitude -= plane.speed * 0.2;
-            plane.fuel -= plane.throttle * 0.05;
-            plane.distance_remaining -= plane.speed / 3600.0;
-            if (plane.altitude <= 0) {
-                plane.altitude = 0;
-                plane.flaps = 0;
+            *speed -= 5.0 * dt;
+            *altitude -= *speed * 0.2 * dt;
+            *fuel -= throttle * 0.05 * dt;
+            if (*altitude <= 0) {
+                *altitude = 0;
+                *flaps = 0;
             }
             break;
     }
 }
 
-// Log data
-void logData(FILE* log) {
-    fprintf(log, "[%d s] Phase: %s, Alt: %.0f ft, Speed: %.0f kt (GS: %.0f kt), "
-                "Heading: %.0f°, Bank: %.0f°, VS: %.0f ft/min, "
-                "Fuel: %.1f gal, Dist: %.0f nm, "
-                "Flaps: %d°, Gear: %s, AP: %s, XPDR: %s "
-                "[%s -> %s]\n",
-            flight_time, getPhaseName(plane.phase),
-            plane.altitude, plane.speed, plane.ground_speed,
-            plane.heading, plane.bank_angle, plane.vertical_speed,
-            plane.fuel, plane.distance_remaining,
-            plane.flaps, plane.gear ? "DOWN" : "UP",
-            plane.autopilot ? "ON" : "OFF",
-            plane.transponder ? "ON" : "OFF",
-            airports[dep_idx].name, airports[dest_idx].name);
+// Update flight: rates are per second, integrated over dt seconds
+void updateFlight(float dt) {
+    flightPhaseStep(&plane.speed, &plane.altitude, &plane.fuel, &plane.phase, &plane.flaps, &plane.gear,
+                    plane.throttle, plane.distance_remaining, dt, lagFactor(0.05, dt), lagFactor(0.1, dt));
 }
 
-// Get phase name
-const char* getPhaseName(int phase) {
-    switch (phase) {
-        case 0: return "Ground";
-        case 1: return "Takeoff";
-        case 2: return "Climb";
-        case 3: return "Cruise";
-        case 4: return "Descent";
-        case 5: return "Landing";
-        default: return "Unknown";
+// Advance the physics by one step of dt seconds; step numbers the
+// physics steps of the flight and picks the weather random numbers
+void integrateStep(float dt, unsigned int step) {
+    PROFILE_SAMPLED(STAGE_UPDATE_FLIGHT, updateFlight(dt));
+    PROFILE_SAMPLED(STAGE_AERODYNAMICS, calculateAerodynamics());
+    PROFILE_SAMPLED(STAGE_WIND_EFFECT, calculateWindEffect(step * dt));
+    PROFILE_SAMPLED(STAGE_NAVIGATION, updateNavigation(dt));
+    PROFILE_SAMPLED(STAGE_ENVELOPE, checkFlightEnvelope());
+    PROFILE_SAMPLED(STAGE_INSTRUMENTS, updateInstruments(dt));
+    PROFILE_SAMPLED(STAGE_WEATHER, updateWeather(dt, step));
+}
+
+// Advance the simulation by one tick: sim_tick seconds in sim_substeps
+// physics steps, stopping early if the flight ends mid-tick
+void stepSimulation(void) {
+    float dt = (float)sim_tick / sim_substeps;
+    unsigned int first = (unsigned int)(flight_time / sim_tick) * sim_substeps;
+    PROFILE_TICK();
+    for (int s = 0; s < sim_substeps; s++) {
+        if (s > 0 && flightComplete()) break;
+        integrateStep(dt, first + s);
     }
 }
 
-// Calculate distance
-float calculateDistance(float lat1, float lon1, float lat2, float lon2) {
-    float dlat = (lat2 - lat1) * PI / 180.0;
-    float dlon = (lon2 - lon1) * PI / 180.0;
-    lat1 *= PI / 180.0; lat2 *= PI / 180.0;
-    float a = sin(dlat / 2) * sin(dlat / 2) + cos(lat1) * cos(lat2) * sin(dlon / 2) * sin(dlon / 2);
+// Blend two physics states for display, alpha 0 = from, 1 = to.
+// Discrete state (phase, gear, ...) is taken from the newer state.
+void interpolateFlight(struct FlightData* out, const struct FlightData* from,
+                       const struct FlightData* to, float alpha) {
+    *out = *to;
+#define X(name) out->name = from->name + (to->name - from->name) * alpha;
+    X(altitude) X(speed) X(ground_speed) X(bank_angle) X(vertical_speed) X(fuel)
+    X(distance_remaining) X(lat) X(lon) X(true_airspeed) X(indicated_airspeed) X(mach_number)
+#undef X
+    float turn = fmodf(to->heading - from->heading, 360.0f);
+    if (turn > 180) turn -= 360;
+    else if (turn < -180) turn += 360;
+    out->heading = from->heading + turn * alpha; // the short way round
+}
+
+// Check for landing or fuel exhaustion
+int flightComplete(void) {
+    return plane.fuel <= 0 || (plane.phase == 5 && plane.altitude <= 0);
+}
+
+// Capture the simulation state
+void snapshotTake(struct Snapshot* snapshot) {
+    snapshot->plane = plane;
+    snapshot->weather = current_weather;
+    snapshot->flight_time = flight_time;
+    snapshot->warning_count = warning_count;
+    snapshot->seed = sim_seed;
+    snapshot->tick = sim_tick;
+    snapshot->substeps = sim_substeps;
+    snapshot->dep = dep_idx;
+    snapshot->dest = dest_idx;
+    memcpy(snapshot->via, route_via, sizeof(route_via));
+    snapshot->via_count = route_via_count;
+    snapshot->plan = flight_plan;
+}
+
+// Continue the simulation from a snapshot
+void snapshotRestore(const struct Snapshot* snapshot) {
+    plane = snapshot->plane;
+    current_weather = snapshot->weather;
+    flight_time = snapshot->flight_time;
+    warning_count = snapshot->warning_count;
+    sim_seed = snapshot->seed;
+    sim_tick = snapshot->tick;
+    sim_substeps = snapshot->substeps;
+    dep_idx = snapshot->dep;
+    dest_idx = snapshot->dest;
+    memcpy(route_via, snapshot->via, sizeof(route_via));
+    route_via_count = snapshot->via_count;
+    flight_plan = snapshot->plan;
+    initAircraftPerformance(plane.type);
+}
+
+// Serialise a snapshot into out, returns the blob size or 0 if it does not fit.
+// Airports and the aircraft type are stored by code and the flight plan is
+// left out, so a blob stays valid when other airports or types are loaded.
+size_t snapshotEncode(const struct Snapshot* snapshot, unsigned char* out, size_t size) {
+    int codes = snapshot->via_count + 3;
+    size_t needed = sizeof(struct SnapshotHeader) + (size_t)codes * SNAPSHOT_CODE +
+                    sizeof(struct FlightData) + sizeof(struct Weather);
+    if (needed > size) return 0;
+    struct SnapshotHeader header = {0};
+    memcpy(header.magic, "APMS", 4);
+    header.version = SNAPSHOT_VERSION;
+    header.via_count = (uint16_t)snapshot->via_count;
+    header.flight_time = snapshot->flight_time;
+    header.warning_count = snapshot->warning_count;
+    header.seed = snapshot->seed;
+    header.tick = snapshot->tick;
+    header.substeps = snapshot->substeps;
+    memcpy(out, &header, sizeof(header));
+    char* code = (char*)out + sizeof(header);
+    memset(code, 0, (size_t)codes * SNAPSHOT_CODE);
+    snprintf(code, SNAPSHOT_CODE, "%s", getAircraftCode(snapshot->plane.type));
+    snprintf(code + SNAPSHOT_CODE, SNAPSHOT_CODE, "%s", airports[snapshot->dep].code);
+    for (int i = 0; i < snapshot->via_count; i++) {
+        snprintf(code + (2 + i) * SNAPSHOT_CODE, SNAPSHOT_CODE, "%s", airports[snapshot->via[i]].code);
+    }
+    snprintf(code + (codes - 1) * SNAPSHOT_CODE, SNAPSHOT_CODE, "%s", airports[snapshot->dest].code);
+    unsigned char* state = out + sizeof(header) + (size_t)codes * SNAPSHOT_CODE;
+    memcpy(state, &snapshot->plane, sizeof(struct FlightData));
+    memcpy(state + sizeof(struct FlightData), &snapshot->weather, sizeof(struct Weather));
+    return needed;
+}
+
+// Restore a snapshot from a blob written by snapshotEncode(), looking up
+// its codes and rebuilding the flight plan; returns 0 if it is invalid
+int snapshotDecode(struct Snapshot* snapshot, const unsigned char* in, size_t size) {
+    struct SnapshotHeader header;
+    if (size < sizeof(header)) return 0;
+    memcpy(&header, in, sizeof(header));
+    if (memcmp(header.magic, "APMS", 4) != 0 || header.version != SNAPSHOT_VERSION ||
+        header.via_count > MAX_WAYPOINTS) return 0;
+    int codes = header.via_count + 3;
+    if (size != sizeof(header) + (size_t)codes * SNAPSHOT_CODE + sizeof(struct FlightData) + sizeof(struct Weather)) {
+        return 0;
+    }
+    char code[MAX_WAYPOINTS + 3][SNAPSHOT_CODE];
+    memcpy(code, in + sizeof(header), (size_t)codes * SNAPSHOT_CODE);
+    for (int i = 0; i < codes; i++) code[i][SNAPSHOT_CODE - 1] = '\0';
+    int type = findAircraftType(code[0]);
+    snapshot->dep = findAirport(code[1]);
+    snapshot->dest = findAirport(code[codes - 1]);
+    snapshot->via_count = header.via_count;
+    int known = type >= 0 && snapshot->dep >= 0 && snapshot->dest >= 0;
+    for (int i = 0; i < snapshot->via_count; i++) {
+        snapshot->via[i] = findAirport(code[2 + i]);
+        if (snapshot->via[i] < 0) known = 0;
+    }
+    if (!known) return 0;
+    if (header.tick < 1 || header.tick > MAX_TICK || header.substeps < 1 || header.substeps > MAX_SUBSTEPS ||
+        header.flight_time < 0) return 0; // would divide by zero or never finish a tick
+    const unsigned char* state = in + sizeof(header) + (size_t)codes * SNAPSHOT_CODE;
+    memcpy(&snapshot->plane, state, sizeof(struct FlightData));
+    memcpy(&snapshot->weather, state + sizeof(struct FlightData), sizeof(struct Weather));
+    snapshot->plane.type = type;
+    snapshot->flight_time = header.flight_time;
+    snapshot->warning_count = header.warning_count;
+    snapshot->seed = header.seed;
+    snapshot->tick = header.tick;
+    snapshot->substeps = header.substeps;
+    return buildFlightPlan(&snapshot->plan, snapshot->dep, snapshot->via, snapshot->via_count, snapshot->dest) &&
+           snapshot->plane.leg >= 0 && snapshot->plane.leg < snapshot->plan.leg_count;
+}
+
+// Write a snapshot blob to a file
+int snapshotSave(const struct Snapshot* snapshot, const char* path) {
+    unsigned char blob[SNAPSHOT_MAX_SIZE];
+    size_t size = snapshotEncode(snapshot, blob, sizeof(blob));
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        printf("ERROR: Could not open %s!\n", path);
+        return 0;
+    }
+    int written = fwrite(blob, 1, size, file) == size;
+    if (fclose(file) != 0 || !written) {
+        printf("ERROR: Could not write %s!\n", path);
+        return 0;
+    }
+    return 1;
+}
+
+// Read a snapshot blob from a file
+int snapshotLoad(struct Snapshot* snapshot, const char* path) {
+    unsigned char blob[SNAPSHOT_MAX_SIZE + 1];
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        printf("ERROR: Could not open %s!\n", path);
+        return 0;
+    }
+    size_t size = fread(blob, 1, sizeof(blob), file);
+    fclose(file);
+    if (!snapshotDecode(snapshot, blob, size)) {
+        printf("ERROR: %s is not a snapshot for the loaded airports and aircraft!\n", path);
+        return 0;
+    }
+    return 1;
+}
+
+// Log data
+void logData(FILE* log) {
+    char line[512];
+    formatLogLine(line, sizeof(line), flight_time, &plane, airports[dep_idx].name, airports[dest_idx].name);
+    fputs(line, log);
+}
+
+// Format one text log line
+int formatLogLine(char* buffer, size_t size, int time, const struct FlightData* aircraft,
+                  const char* dep, const char* dest) {
+    return snprintf(buffer, size,
+                "[%d s] Phase: %s, Alt: %.0f ft, Speed: %.0f kt (GS: %.0f kt), "
+                "Heading: %.0f°, Bank: %.0f°, VS: %.0f ft/min, "
+                "Fuel: %.1f gal, Dist: %.0f nm, "
+                "Flaps: %d°, Gear: %s, AP: %s, XPDR: %s "
+                "[%s -> %s]\n",
+            time, getPhaseName(aircraft->phase),
+            aircraft->altitude, aircraft->speed, aircraft->ground_speed,
+            aircraft->heading, aircraft->bank_angle, aircraft->vertical_speed,
+            aircraft->fuel, aircraft->distance_remaining,
+            aircraft->flaps, aircraft->gear ? "DOWN" : "UP",
+            aircraft->autopilot ? "ON" : "OFF",
+            aircraft->transponder ? "ON" : "OFF",
+            dep, dest);
+}
+
+// Open a binary flight log and write its header
+struct LogRecorder* recorderOpen(const char* path, AircraftType type, int dep, int dest) {
+    struct LogRecorder* recorder = calloc(1, sizeof(struct LogRecorder));
+    if (!recorder) return NULL;
+    recorder->file = fopen(path, "wb");
+    if (!recorder->file) {
+        free(recorder);
+        return NULL;
+    }
+    struct LogHeader header = {0};
+    memcpy(header.magic, "APMB", 4);
+    header.version = LOG_SCHEMA_VERSION;
+    header.block_ticks = LOG_BLOCK_TICKS;
+    header.aircraft_type = type;
+    header.byte_order = LOG_BYTE_ORDER;
+    snprintf(header.dep_code, sizeof(header.dep_code), "%s", airports[dep].code);
+    snprintf(header.dest_code, sizeof(header.dest_code), "%s", airports[dest].code);
+    snprintf(header.dep_name, sizeof(header.dep_name), "%s", airports[dep].name);
+    snprintf(header.dest_name, sizeof(header.dest_name), "%s", airports[dest].name);
+    fwrite(&header, sizeof(header), 1, recorder->file);
+    return recorder;
+}
+
+// Record one tick
+void recorderAppend(struct LogRecorder* recorder, int time, const struct FlightData* aircraft) {
+    uint32_t n = recorder->count;
+    recorder->time[n] = time;
+#define X(name) recorder->name[n] = aircraft->name;
+    LOG_FLOAT_COLUMNS(X)
+#undef X
+    recorder->phase[n] = (uint8_t)aircraft->phase;
+    recorder->flaps[n] = (uint8_t)aircraft->flaps;
+    recorder->flags[n] = (aircraft->gear ? LOG_FLAG_GEAR : 0) |
+                         (aircraft->autopilot ? LOG_FLAG_AUTOPILOT : 0) |
+                         (aircraft->transponder ? LOG_FLAG_TRANSPONDER : 0);
+    if (++recorder->count == LOG_BLOCK_TICKS) recorderFlush(recorder);
+}
+
+// Write the buffered ticks as one block
+void recorderFlush(struct LogRecorder* recorder) {
+    uint32_t n = recorder->count;
+    if (n == 0) return;
+    fwrite(&n, sizeof(n), 1, recorder->file);
+    fwrite(recorder->time, sizeof(int32_t), n, recorder->file);
+#define X(name) fwrite(recorder->name, sizeof(recorder->name[0]), n, recorder->file);
+    LOG_FLOAT_COLUMNS(X)
+    LOG_BYTE_COLUMNS(X)
+#undef X
+    recorder->count = 0;
+}
+
+// Mark the end of a flight, the text log's [END] line
+void recorderEndFlight(struct LogRecorder* recorder) {
+    uint32_t end = 0;
+    recorderFlush(recorder);
+    fwrite(&end, sizeof(end), 1, recorder->file);
+}
+
+// Flush and close the log
+void recorderClose(struct LogRecorder* recorder) {
+    if (!recorder) return;
+    recorderFlush(recorder);
+    fclose(recorder->file);
+    free(recorder);
+}
+
+// Convert a binary flight log back to the text format.
+// Usage: apm --convert flight_log.apm [flight_log.txt]
+int convertLog(const char* in_path, const char* out_path) {
+    FILE* in = fopen(in_path, "rb");
+    if (!in) {
+        printf("ERROR: Could not open %s!\n", in_path);
+        return 1;
+    }
+    struct LogHeader header;
+    if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, "APMB", 4) != 0 ||
+        header.version != LOG_SCHEMA_VERSION || header.block_ticks > LOG_BLOCK_TICKS) {
+        printf("ERROR: %s is not a version %d binary flight log!\n", in_path, LOG_SCHEMA_VERSION);
+        fclose(in);
+        return 1;
+    }
+    if (header.byte_order != LOG_BYTE_ORDER) {
+        printf("ERROR: %s was written on a machine of the other byte order!\n", in_path);
+        fclose(in);
+        return 1;
+    }
+    FILE* out = out_path ? fopen(out_path, "w") : stdout;
+    struct LogRecorder* block = malloc(sizeof(struct LogRecorder));
+    if (!out || !block) {
+        printf("ERROR: Could not open %s!\n", out_path ? out_path : "output");
+        if (out && out != stdout) fclose(out);
+        free(block);
+        fclose(in);
+        return 1;
+    }
+    header.dep_name[sizeof(header.dep_name) - 1] = '\0';
+    header.dest_name[sizeof(header.dest_name) - 1] = '\0';
+
+    struct FlightData aircraft = {0};
+    int ticks = 0;
+    uint32_t n;
+    char line[512];
+    while (fread(&n, sizeof(n), 1, in) == 1) {
+        if (n == 0) {
+            if (ticks > 0) {
+                fprintf(out, "[END] Alt: %.0f ft, Speed: %.0f kt, Fuel: %.1f gal, Dist Remain: %.0f nm\n",
+                        aircraft.altitude, aircraft.speed, aircraft.fuel, aircraft.distance_remaining);
+            }
+            ticks = 0;
+            continue;
+        }
+        if (n > header.block_ticks) break;
+        size_t ok = fread(block->time, sizeof(int32_t), n, in) == n;
+#define X(name) ok = ok && fread(block->name, sizeof(block->name[0]), n, in) == n;
+        LOG_FLOAT_COLUMNS(X)
+        LOG_BYTE_COLUMNS(X)
+#undef X
+        if (!ok) break;
+        for (uint32_t t = 0; t < n; t++) {
+#define X(name) aircraft.name = block->name[t];
+            LOG_FLOAT_COLUMNS(X)
+#undef X
+            aircraft.phase = block->phase[t];
+            aircraft.flaps = block->flaps[t];
+            aircraft.gear = (block->flags[t] & LOG_FLAG_GEAR) != 0;
+            aircraft.autopilot = (block->flags[t] & LOG_FLAG_AUTOPILOT) != 0;
+            aircraft.transponder = (block->flags[t] & LOG_FLAG_TRANSPONDER) != 0;
+            formatLogLine(line, sizeof(line), block->time[t], &aircraft, header.dep_name, header.dest_name);
+            fputs(line, out);
+            ticks++;
+        }
+    }
+    if (ticks > 0 || !feof(in)) {
+        fprintf(stderr, "WARNING: %s ends mid-flight\n", in_path);
+    }
+    if (out != stdout) fclose(out);
+    free(block);
+    fclose(in);
+    return 0;
+}
+
+// Open a file for mapping
+int mapOpen(struct MappedFile* map, const char* path) {
+    *map = (struct MappedFile){0};
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    LARGE_INTEGER size;
+    GetSystemInfo(&info);
+    map->granularity = info.dwAllocationGranularity;
+    map->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (map->file == INVALID_HANDLE_VALUE) return 0;
+    if (!GetFileSizeEx(map->file, &size)) {
+        CloseHandle(map->file);
+        return 0;
+    }
+    map->size = size.QuadPart;
+    if (map->size > 0) {
+        map->mapping = CreateFileMappingA(map->file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!map->mapping) {
+            CloseHandle(map->file);
+            return 0;
+        }
+    }
+#else
+    struct stat st;
+    map->granularity = sysconf(_SC_PAGESIZE);
+    map->fd = open(path, O_RDONLY);
+    if (map->fd < 0) return 0;
+    if (fstat(map->fd, &st) != 0) {
+        close(map->fd);
+        return 0;
+    }
+    map->size = st.st_size;
+#endif
+    return 1;
+}
+
+// Map length bytes at offset (a multiple of map->granularity)
+const char* mapView(struct MappedFile* map, long long offset, size_t length) {
+#ifdef _WIN32
+    return MapViewOfFile(map->mapping, FILE_MAP_READ, (DWORD)(offset >> 32), (DWORD)offset, length);
+#else
+    void* view = mmap(NULL, length, PROT_READ, MAP_PRIVATE, map->fd, offset);
+    if (view == MAP_FAILED) return NULL;
+    posix_madvise(view, length, POSIX_MADV_SEQUENTIAL);
+    return view;
+#endif
+}
+
+// Unmap a view
+void mapRelease(const char* view, size_t length) {
+#ifdef _WIN32
+    (void)length;
+    UnmapViewOfFile(view);
+#else
+    munmap((void*)view, length);
+#endif
+}
+
+// Close a mapped file
+void mapClose(struct MappedFile* map) {
+#ifdef _WIN32
+    if (map->mapping) CloseHandle(map->mapping);
+    CloseHandle(map->file);
+#else
+    close(map->fd);
+#endif
+}
+
+// Load a weather grid (--weather). The file stays mapped and tiles are
+// read from it as aircraft reach them.
+int weatherOpen(const char* path) {
+    if (weather_grid) {
+        printf("ERROR: Only one weather grid can be loaded!\n");
+        return 0;
+    }
+    struct WeatherGrid* grid = calloc(1, sizeof(struct WeatherGrid));
+    if (!grid) {
+        printf("ERROR: Out of memory loading %s!\n", path);
+        return 0;
+    }
+    if (!mapOpen(&grid->file, path)) {
+        printf("ERROR: Could not open %s!\n", path);
+        free(grid);
+        return 0;
+    }
+    const struct WeatherHeader* h = &grid->header;
+    const char* view = grid->file.size >= (long long)sizeof(struct WeatherHeader)
+                       ? mapView(&grid->file, 0, sizeof(struct WeatherHeader)) : NULL;
+    if (view) {
+        memcpy(&grid->header, view, sizeof(struct WeatherHeader));
+        mapRelease(view, sizeof(struct WeatherHeader));
+    }
+    int valid = view && memcmp(h->magic, "APMW", 4) == 0 && h->version == WEATHER_VERSION &&
+                h->tile == WEATHER_TILE && h->lat_count >= 2 && h->lon_count >= 2 && h->level_count >= 2 &&
+                h->level_count <= WEATHER_MAX_LEVELS && h->time_count >= 1 && h->lat_step > 0 &&
+                h->lon_step > 0 && h->level_step > 0 && (h->time_count == 1 || h->time_step > 0);
+    if (valid) {
+        grid->tiles_lat = (h->lat_count - 2) / WEATHER_TILE + 1;
+        grid->tiles_lon = (h->lon_count - 2) / WEATHER_TILE + 1;
+        grid->tile_floats = WEATHER_LEVEL * h->level_count;
+        grid->lat_scale = 1 / h->lat_step;
+        grid->lon_scale = 1 / h->lon_step;
+        grid->level_scale = 1 / h->level_step;
+        grid->time_scale = h->time_count > 1 ? 1 / h->time_step : 0;
+        double tiles = (double)h->time_count * grid->tiles_lat * grid->tiles_lon; // tile numbers are ints
+        valid = tiles < INT_MAX && grid->file.size == (long long)sizeof(struct WeatherHeader) +
+                (long long)tiles * grid->tile_floats * (long long)sizeof(float);
+    }
+    if (!valid) {
+        printf("ERROR: %s is not a weather grid!\n", path);
+        mapClose(&grid->file);
+        free(grid);
+        return 0;
+    }
+    if (!weatherCacheCreate(grid, 0)) {
+        mapClose(&grid->file);
+        free(grid);
+        return 0;
+    }
+    weather_grid = grid;
+    printf("Loaded weather grid from %s: %d x %d points, %d levels, %d time slices (%.1f MB)\n",
+           path, h->lat_count, h->lon_count, h->level_count, h->time_count, grid->file.size / 1048576.0);
+    return 1;
+}
+
+// Give a worker its own weather tile cache
+int weatherCacheCreate(struct WeatherGrid* grid, int worker) {
+    if (grid->cache[worker]) return 1;
+    struct WeatherCache* cache = calloc(1, sizeof(struct WeatherCache));
+    float* tiles = malloc(sizeof(float) * grid->tile_floats * WEATHER_SETS * WEATHER_WAYS);
+    if (!cache || !tiles) {
+        printf("ERROR: Out of memory for the weather tile cache!\n");
+        free(cache);
+        free(tiles);
+        return 0;
+    }
+    for (int i = 0; i < WEATHER_SETS * WEATHER_WAYS; i++) cache->key[i] = -1;
+    cache->tiles = tiles;
+    grid->cache[worker] = cache;
+    return 1;
+}
+
+// Read a weather tile that missed in the cache into the least recently
+// used way of its set, returns the slot. A vector of aircraft looks
+// up at most 2 * SIMD_LANES tiles, fewer than WEATHER_WAYS, so none of
+// them is evicted before the kernel has gathered from it.
+int weatherLoad(struct WeatherGrid* grid, struct WeatherCache* cache, int key) {
+    int first = key % WEATHER_SETS * WEATHER_WAYS;
+    int slot = first;
+    for (int way = first + 1; way < first + WEATHER_WAYS; way++) {
+        if (cache->used[way] < cache->used[slot]) slot = way;
+    }
+    size_t bytes = sizeof(float) * grid->tile_floats;
+    long long offset = sizeof(struct WeatherHeader) + (long long)key * bytes;
+    long long start = offset - offset % grid->file.granularity;
+    const char* view = mapView(&grid->file, start, bytes + (offset - start));
+    float* tile = cache->tiles + (size_t)slot * grid->tile_floats;
+    if (view) {
+        memcpy(tile, view + (offset - start), bytes);
+        mapRelease(view, bytes + (offset - start));
+    } else {
+        printf("ERROR: Could not map weather tile %d!\n", key);
+        memset(tile, 0, bytes);
+    }
+    cache->key[slot] = key;
+    cache->loads++;
+    return slot;
+}
+
+// Sample the weather grid for one aircraft: wind toward the east and north
+// (kt) and temperature (C), trilinear in each of the two time slices
+// around the flight time (s), then linear between them
+void weatherSample(int worker, float lat, float lon, float altitude, float time, float* out) {
+    struct WeatherCache* cache = weather_grid->cache[worker];
+    int corner[2];
+    float weight[4];
+    weatherLocate(weather_grid, cache, lat, lon, altitude, time, corner, weight);
+    for (int f = 0; f < WEATHER_FIELDS; f++) {
+        float now = weatherBlend(cache->tiles + corner[0] + f, weight);
+        float next = weatherBlend(cache->tiles + corner[1] + f, weight);
+        out[f] = now + (next - now) * weight[3];
+    }
+}
+
+// Analytic weather written by --make-weather: a westerly jet core near
+// 30N and 35,000 ft, a wave drifting east 2 deg an hour, and standard
+// temperatures 10 C warmer at the equator, falling 2.5 C per 10 deg north
+void weatherSynthetic(float lat, float lon, float altitude, float time, float* out) {
+    float jet = expf(-powf((lat - 30) / 8, 2) - powf((altitude - 35000) / 12000, 2));
+    float wave = (lon - 2 * time / 3600) * (float)(2 * PI / 20);
+    out[0] = 10 + 110 * jet + 10 * cosf(wave);
+    out[1] = 25 * expf(-powf((lat - 25) / 15, 2)) * sinf(wave);
+    out[2] = isaLookup(isa.temperature, altitude) + 10 - lat / 4;
+}
+
+// Write a sample weather grid for --weather: 1 deg over 0-40N, 60-100E,
+// every 1,500 ft to 45,000 ft and every hour for a day
+int writeWeatherGrid(const char* path) {
+    struct WeatherHeader h = {{'A', 'P', 'M', 'W'}, WEATHER_VERSION, WEATHER_TILE,
+                              41, 41, 31, 25, 0, 60, 1, 1, 0, 1500, 3600, 0};
+    int tiles_lat = (h.lat_count - 2) / WEATHER_TILE + 1;
+    int tiles_lon = (h.lon_count - 2) / WEATHER_TILE + 1;
+    int tile_floats = WEATHER_LEVEL * h.level_count;
+    float* tile = malloc(sizeof(float) * tile_floats);
+    if (!tile) {
+        printf("ERROR: Out of memory!\n");
+        return 1;
+    }
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        printf("ERROR: Could not open %s!\n", path);
+        free(tile);
+        return 1;
+    }
+    int ok = fwrite(&h, sizeof(h), 1, file) == 1;
+    for (int t = 0; t < h.time_count; t++) {
+        for (int tile_row = 0; tile_row < tiles_lat; tile_row++) {
+            for (int tile_col = 0; tile_col < tiles_lon; tile_col++) {
+                float* p = tile;
+                for (int level = 0; level < h.level_count; level++) {
+                    for (int r = 0; r < WEATHER_POINTS; r++) {
+                        for (int c = 0; c < WEATHER_POINTS; c++, p += WEATHER_FIELDS) {
+                            int row = tile_row * WEATHER_TILE + r; // past the edge: repeat the last point
+                            int col = tile_col * WEATHER_TILE + c;
+                            if (row >= h.lat_count) row = h.lat_count - 1;
+                            if (col >= h.lon_count) col = h.lon_count - 1;
+                            weatherSynthetic(h.lat0 + row * h.lat_step, h.lon0 + col * h.lon_step,
+                                             h.level0 + level * h.level_step, t * h.time_step, p);
+                        }
+                    }
+                }
+                ok = ok && fwrite(tile, sizeof(float), tile_floats, file) == (size_t)tile_floats;
+            }
+        }
+    }
+    ok = fclose(file) == 0 && ok;
+    free(tile);
+    if (!ok) {
+        printf("ERROR: Could not write %s!\n", path);
+        return 1;
+    }
+    printf("Wrote weather grid %s: %d x %d points, %d levels, %d time slices\n",
+           path, h.lat_count, h.lon_count, h.level_count, h.time_count);
+    return 0;
+}
+
+// Find the next c in [p, end), 16 bytes per compare when SIMD is on
+const char* findByte(const char* p, const char* end, char c) {
+#ifdef SIMD_LANES
+    const __m128i needle = _mm_set1_epi8(c);
+    for (; p + 16 <= end; p += 16) {
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), needle));
+        if (mask) return p + __builtin_ctz(mask);
+    }
+#endif
+    for (; p < end; p++) {
+        if (*p == c) return p;
+    }
+    return NULL;
+}
+
+// Parse a decimal number such as -1234.5, stopping at the first other character
+double parseNumber(const char* p, const char* end) {
+    double value = 0, scale = 0.1;
+    int negative = 0;
+    while (p < end && *p == ' ') p++;
+    if (p < end && *p == '-') {
+        negative = 1;
+        p++;
+    }
+    for (; p < end && *p >= '0' && *p <= '9'; p++) value = value * 10 + (*p - '0');
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++, scale *= 0.1) value += (*p - '0') * scale;
+    }
+    return negative ? -value : value;
+}
+
+// Account one log line. Fields are found by key (the word before each ':')
+// so both the Phase 2 and the Phase 3/4 layouts are understood.
+void queryLine(struct LogQuery* query, const char* line, const char* end) {
+    query->lines++;
+    if (end > line && end[-1] == '\r') end--;
+    if (end - line >= 9 && (memcmp(line, "[WARNING]", 9) == 0 || memcmp(line, "[CRITICAL", 9) == 0)) {
+        query->warnings++;
+        return;
+    }
+    if (end - line >= 5 && memcmp(line, "[END]", 5) == 0) {
+        if (query->in_flight) query->flights++;
+        query->in_flight = 0;
+        query->have_fuel = 0;
+        return;
+    }
+    if (end - line < 4 || line[0] != '[' || line[1] < '0' || line[1] > '9') return;
+
+    long long time = (long long)parseNumber(line + 1, end);
+    int phase = NUM_PHASES;
+    double altitude = 0, fuel = -1;
+    for (const char* colon = findByte(line, end, ':'); colon; colon = findByte(colon + 1, end, ':')) {
+        const char* value = colon + 1;
+        if (colon - line >= 5 && memcmp(colon - 5, "Phase", 5) == 0) {
+            while (value < end && *value == ' ') value++;
+            const char* stop = value;
+            while (stop < end && *stop != ',' && *stop != ' ') stop++;
+            for (int i = 0; i < NUM_PHASES; i++) {
+                const char* name = getPhaseName(i);
+                if ((size_t)(stop - value) == strlen(name) && memcmp(value, name, stop - value) == 0) phase = i;
+            }
+        } else if (colon - line >= 3 && memcmp(colon - 3, "Alt", 3) == 0) {
+            altitude = parseNumber(value, end);
+        } else if (colon - line >= 4 && memcmp(colon - 4, "Fuel", 4) == 0) {
+            fuel = parseNumber(value, end);
+        }
+    }
+
+    // A clock going backwards means a new flight without an [END] line
+    if (query->in_flight && time < query->last_time) {
+        query->flights++;
+        query->have_fuel = 0;
+    }
+    query->in_flight = 1;
+    query->ticks++;
+    query->phase_time[phase]++;
+    if (fuel >= 0) {
+        if (query->have_fuel) query->phase_fuel[phase] += query->last_fuel - fuel;
+        query->last_fuel = fuel;
+        query->have_fuel = 1;
+    }
+    if (altitude > query->max_altitude || query->ticks == 1) {
+        query->max_altitude = altitude;
+        query->max_altitude_time = time;
+        query->max_altitude_flight = query->flights + 1;
+    }
+    query->last_time = time;
+}
+
+// Summarize a text flight log without reading it into memory.
+// Usage: apm --query flight_log.txt
+int queryLog(const char* path) {
+    struct MappedFile map;
+    if (!mapOpen(&map, path)) {
+        printf("ERROR: Could not open %s!\n", path);
+        return 1;
+    }
+    struct LogQuery query = {0};
+    long long offset = 0; // first byte not yet parsed
+    while (offset < map.size) {
+        long long base = offset - offset % map.granularity;
+        size_t length = map.size - base < MAP_WINDOW ? (size_t)(map.size - base) : MAP_WINDOW;
+        const char* view = mapView(&map, base, length);
+        if (!view) {
+            printf("ERROR: Could not map %s at offset %lld!\n", path, base);
+            mapClose(&map);
+            return 1;
+        }
+        const char* end = view + length;
+        const char* p = view + (offset - base);
+        int last_window = base + (long long)length == map.size;
+        for (;;) {
+            const char* newline = findByte(p, end, '\n');
+            if (!newline) {
+                // Partial line: finish it here on the last window, else remap from its start
+                if (last_window && p < end) {
+                    queryLine(&query, p, end);
+                    p = end;
+                }
+                break;
+            }
+            queryLine(&query, p, newline);
+            p = newline + 1;
+        }
+        long long next = base + (p - view);
+        mapRelease(view, length);
+        if (next == offset && !last_window) {
+            printf("ERROR: Line longer than %d bytes at offset %lld!\n", MAP_WINDOW, offset);
+            mapClose(&map);
+            return 1;
+        }
+        offset = last_window ? map.size : next;
+    }
+    mapClose(&map);
+    if (query.in_flight) query.flights++;
+
+    printf("Log: %s (%.1f MB, %lld lines, %lld ticks, %d flight(s))\n",
+           path, map.size / 1048576.0, query.lines, query.ticks, query.flights);
+    if (query.ticks > 0) {
+        printf("Max altitude: %.0f ft at %lld s (flight %d)\n",
+               query.max_altitude, query.max_altitude_time, query.max_altitude_flight);
+    }
+    printf("Warnings: %lld\n", query.warnings);
+    printf("%-10s %12s %16s\n", "Phase", "Time (s)", "Fuel burn (gal)");
+    for (int i = 0; i <= NUM_PHASES; i++) {
+        if (query.phase_time[i] == 0) continue;
+        printf("%-10s %12lld %16.1f\n", i < NUM_PHASES ? getPhaseName(i) : "Unknown",
+               query.phase_time[i], query.phase_fuel[i]);
+    }
+    return 0;
+}
+
+// Start an asynchronous writer for a text log or a binary recorder, and
+// a telemetry publisher if one is given
+struct AsyncLog* asyncLogOpen(FILE* text, struct LogRecorder* recorder, struct Telemetry* telemetry,
+                              LogBackpressure policy, const char* dep, const char* dest) {
+    struct AsyncLog* log = calloc(1, sizeof(struct AsyncLog));
+    if (!log) return NULL;
+    log->text = text;
+    log->recorder = recorder;
+    log->telemetry = telemetry;
+    log->policy = policy;
+    log->dep = dep;
+    log->dest = dest;
+    log->wake = SDL_CreateSemaphore(0);
+    log->space = SDL_CreateSemaphore(0);
+    log->thread = SDL_CreateThread(asyncLogThread, "apm-log", log);
+    if (!log->thread) {
+        printf("ERROR: Could not start log writer: %s\n", SDL_GetError());
+        SDL_DestroySemaphore(log->wake);
+        SDL_DestroySemaphore(log->space);
+        free(log);
+        return NULL;
+    }
+    return log;
+}
+
+// Queue a record if there is room, returns 0 when the ring is full
+int asyncLogTryPush(struct AsyncLog* log, const struct LogRecord* record) {
+    unsigned int head = (unsigned int)SDL_AtomicGet(&log->head);
+    unsigned int used = head - (unsigned int)SDL_AtomicGet(&log->tail);
+    if (used >= LOG_RING_SIZE) return 0;
+    log->ring[head & (LOG_RING_SIZE - 1)] = *record;
+    SDL_AtomicSet(&log->head, (int)(head + 1));
+    if (used + 1 == LOG_WRITE_BATCH || record->end) SDL_SemPost(log->wake);
+    return 1;
+}
+
+// Queue a tick snapshot (or an end of flight marker) from the simulation thread
+void asyncLogPush(struct AsyncLog* log, int time, int end, const struct FlightData* aircraft) {
+    struct LogRecord record = {time, end, *aircraft};
+
+    if (log->policy == LOG_GROW) {
+        // Keep order: older spilled records go into the ring first
+        while (log->overflow_start < log->overflow_count &&
+               asyncLogTryPush(log, &log->overflow[log->overflow_start])) {
+            log->overflow_start++;
+        }
+        if (log->overflow_start == log->overflow_count) log->overflow_start = log->overflow_count = 0;
+        if (log->overflow_count == 0 && asyncLogTryPush(log, &record)) return;
+        if (log->overflow_count == log->overflow_capacity) {
+            int capacity = log->overflow_capacity ? log->overflow_capacity * 2 : LOG_RING_SIZE;
+            struct LogRecord* grown = realloc(log->overflow, capacity * sizeof(struct LogRecord));
+            if (!grown) {
+                SDL_AtomicAdd(&log->dropped, 1);
+                return;
+            }
+            log->overflow = grown;
+            log->overflow_capacity = capacity;
+        }
+        log->overflow[log->overflow_count++] = record;
+        if (log->overflow_count - log->overflow_start > log->overflow_peak) {
+            log->overflow_peak = log->overflow_count - log->overflow_start;
+        }
+        return;
+    }
+
+    // Dropping the record in hand rather than the oldest one leaves the
+    // tail to the writer alone, so it never loses a batch it has copied
+    while (!asyncLogTryPush(log, &record)) {
+        if (log->policy == LOG_DROP_NEWEST) {
+            SDL_AtomicAdd(&log->dropped, 1);
+            SDL_SemPost(log->wake);
+            return;
+        }
+        SDL_SemPost(log->wake);
+        SDL_SemWaitTimeout(log->space, 10);
+    }
+}
+
+// Format one record as a text log line, returns the length snprintf needed
+static int formatLogRecord(const struct AsyncLog* log, const struct LogRecord* record, char* buffer, size_t size) {
+    if (record->end) {
+        return snprintf(buffer, size,
+                        "[END] Alt: %.0f ft, Speed: %.0f kt, Fuel: %.1f gal, Dist Remain: %.0f nm\n",
+                        record->data.altitude, record->data.speed, record->data.fuel,
+                        record->data.distance_remaining);
+    }
+    return formatLogLine(buffer, size, record->time, &record->data, log->dep, log->dest);
+}
+
+// Writer side: copy out and write one batch, returns records written
+int asyncLogDrain(struct AsyncLog* log) {
+    int tail = SDL_AtomicGet(&log->tail);
+    unsigned int available = (unsigned int)SDL_AtomicGet(&log->head) - (unsigned int)tail;
+    int n = available < LOG_WRITE_BATCH ? (int)available : LOG_WRITE_BATCH;
+    if (n == 0) return 0;
+    for (int k = 0; k < n; k++) {
+        log->batch[k] = log->ring[((unsigned int)tail + k) & (LOG_RING_SIZE - 1)];
+    }
+    SDL_AtomicSet(&log->tail, (int)((unsigned int)tail + n));
+    SDL_SemPost(log->space);
+
+    if (log->telemetry) telemetryPublish(log->telemetry, log->batch, n);
+    size_t used = 0;
+    for (int k = 0; k < n && (log->recorder || log->text); k++) {
+        const struct LogRecord* record = &log->batch[k];
+        if (log->recorder) {
+            if (record->end) recorderEndFlight(log->recorder);
+            else recorderAppend(log->recorder, record->time, &record->data);
+            continue;
+        }
+        size_t length = formatLogRecord(log, record, log->buffer + used, sizeof(log->buffer) - used);
+        if (used + length < sizeof(log->buffer)) {
+            used += length;
+            continue;
+        }
+        // The line did not fit: write the batch so far, then retry it alone
+        // or, if it is longer than the whole buffer, write it directly
+        fwrite(log->buffer, 1, used, log->text);
+        used = 0;
+        if (length < sizeof(log->buffer)) {
+            used = formatLogRecord(log, record, log->buffer, sizeof(log->buffer));
+        } else {
+            char* line = malloc(length + 1);
+            if (line) {
+                formatLogRecord(log, record, line, length + 1);
+                fwrite(line, 1, length, log->text);
+                free(line);
+            }
+        }
+    }
+    if (log->text && used) fwrite(log->buffer, 1, used, log->text);
+    log->written += n;
+    return n;
+}
+
+// Background writer thread
+int asyncLogThread(void* data) {
+    struct AsyncLog* log = data;
+    for (;;) {
+        int quitting = SDL_AtomicGet(&log->quit);
+        int n = asyncLogDrain(log);
+        if (n == 0) {
+            if (quitting) break;
+            SDL_SemWaitTimeout(log->wake, 100);
+        }
+    }
+    if (log->text) fflush(log->text);
+    return 0;
+}
+
+// Write everything still queued, stop the writer and print its counters.
+// The log file or recorder stays open for the caller to close.
+void asyncLogClose(struct AsyncLog* log) {
+    if (!log) return;
+    while (log->overflow_start < log->overflow_count) {
+        if (asyncLogTryPush(log, &log->overflow[log->overflow_start])) {
+            log->overflow_start++;
+        } else {
+            SDL_SemPost(log->wake);
+            SDL_SemWaitTimeout(log->space, 10);
+        }
+    }
+    SDL_AtomicSet(&log->quit, 1);
+    SDL_SemPost(log->wake);
+    SDL_WaitThread(log->thread, NULL);
+    int dropped = SDL_AtomicGet(&log->dropped);
+    if (dropped > 0 || log->overflow_peak > 0) {
+        printf("Log: %lld records written, %d dropped, overflow peak %d\n",
+               log->written, dropped, log->overflow_peak);
+    }
+    SDL_DestroySemaphore(log->wake);
+    SDL_DestroySemaphore(log->space);
+    free(log->overflow);
+    free(log);
+}
+
+// Start the platform's socket library; nothing to do outside Windows
+static int telemetryStartup(void) {
+#ifdef _WIN32
+    WSADATA data;
+    if (WSAStartup(MAKEWORD(2, 2), &data) != 0) {
+        printf("ERROR: Could not start Winsock!\n");
+        return 0;
+    }
+#endif
+    return 1;
+}
+
+// Release what telemetryStartup() started
+static void telemetryCleanup(void) {
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+// Whether the last socket call failed only because it would have blocked
+// or the socket buffer was full
+static int telemetryWouldBlock(void) {
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS;
+#endif
+}
+
+// Milliseconds on a monotonic clock, without needing SDL_Init()
+static Uint32 telemetryMillis(void) {
+    return (Uint32)(SDL_GetPerformanceCounter() / (SDL_GetPerformanceFrequency() / 1000));
+}
+
+// Parse a telemetry address: PORT or HOST:PORT for UDP, or unix:PATH for
+// a Unix-domain datagram socket. Returns 0 if it is invalid.
+int telemetryAddress(const char* text, struct sockaddr_storage* addr, socklen_t* addr_len) {
+    memset(addr, 0, sizeof(*addr));
+    if (strncmp(text, "unix:", 5) == 0) {
+#ifdef _WIN32
+        printf("ERROR: Unix-domain telemetry sockets are not supported on Windows!\n");
+        return 0;
+#else
+        struct sockaddr_un* local = (struct sockaddr_un*)addr;
+        if (text[5] == '\0' || strlen(text + 5) >= sizeof(local->sun_path) - 16) {
+            printf("ERROR: Invalid socket path %s!\n", text + 5);
+            return 0;
+        }
+        local->sun_family = AF_UNIX;
+        strcpy(local->sun_path, text + 5);
+        *addr_len = sizeof(struct sockaddr_un);
+        return 1;
+#endif
+    }
+    char host[256] = "127.0.0.1";
+    const char* port = strrchr(text, ':');
+    if (port) {
+        size_t length = (size_t)(port - text);
+        if (length == 0 || length >= sizeof(host)) {
+            printf("ERROR: Invalid telemetry address %s!\n", text);
+            return 0;
+        }
+        memcpy(host, text, length);
+        host[length] = '\0';
+        port++;
+    } else {
+        port = text;
+    }
+    struct addrinfo hints = {0}, *found = NULL;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (atoi(port) < 1 || atoi(port) > 65535 || getaddrinfo(host, port, &hints, &found) != 0) {
+        printf("ERROR: Invalid telemetry address %s!\n", text);
+        return 0;
+    }
+    memcpy(addr, found->ai_addr, found->ai_addrlen);
+    *addr_len = (socklen_t)found->ai_addrlen;
+    freeaddrinfo(found);
+    return 1;
+}
+
+// Open a non-blocking datagram socket bound to addr
+static TelemetrySocket telemetryBind(const struct sockaddr_storage* addr, socklen_t addr_len) {
+    TelemetrySocket s = socket(addr->ss_family, SOCK_DGRAM, 0);
+    if (s == INVALID_SOCKET) return INVALID_SOCKET;
+#ifdef _WIN32
+    u_long on = 1;
+    int ok = ioctlsocket(s, FIONBIO, &on) == 0;
+#else
+    int ok = fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK) == 0;
+#endif
+    if (!ok || bind(s, (const struct sockaddr*)addr, addr_len) != 0) {
+        closesocket(s);
+        return INVALID_SOCKET;
+    }
+    return s;
+}
+
+// Remove the socket file of a Unix-domain address, if there is one
+static void telemetryUnlink(const struct sockaddr_storage* addr) {
+#ifndef _WIN32
+    struct stat info;
+    const char* path = ((const struct sockaddr_un*)addr)->sun_path;
+    if (addr->ss_family == AF_UNIX && stat(path, &info) == 0 && S_ISSOCK(info.st_mode)) unlink(path);
+#else
+    (void)addr;
+#endif
+}
+
+// Open a telemetry publisher at address, returns NULL on error. A stale
+// socket file left at a unix: path by an earlier run is replaced.
+struct Telemetry* telemetryOpen(const char* address) {
+    if (!telemetryStartup()) return NULL;
+    struct Telemetry* telemetry = calloc(1, sizeof(struct Telemetry));
+    if (!telemetry || !telemetryAddress(address, &telemetry->addr, &telemetry->addr_len)) {
+        free(telemetry);
+        telemetryCleanup();
+        return NULL;
+    }
+    telemetryUnlink(&telemetry->addr);
+    telemetry->socket = telemetryBind(&telemetry->addr, telemetry->addr_len);
+    if (telemetry->socket == INVALID_SOCKET) {
+        printf("ERROR: Could not open telemetry socket %s!\n", address);
+        free(telemetry);
+        telemetryCleanup();
+        return NULL;
+    }
+    return telemetry;
+}
+
+// Take subscribe and unsubscribe requests, and drop subscribers whose
+// keepalives stopped. Reads a bounded number so requests cannot starve
+// the log.
+void telemetryPoll(struct Telemetry* telemetry) {
+    Uint32 now = telemetryMillis();
+    for (int i = 0; i < 64; i++) {
+        char request[16];
+        struct sockaddr_storage from;
+        socklen_t from_len = sizeof(from);
+        int n = (int)recvfrom(telemetry->socket, request, sizeof(request), 0, (struct sockaddr*)&from, &from_len);
+        if (n < 0) {
+            if (telemetryWouldBlock()) break;
+            continue; // Windows reports an earlier send to a closed port here
+        }
+        int unsubscribe = n == 11 && memcmp(request, "unsubscribe", 11) == 0;
+        if (!unsubscribe && !(n == 9 && memcmp(request, "subscribe", 9) == 0)) continue;
+        if (from_len <= (socklen_t)sizeof(from.ss_family)) continue; // unbound, cannot be sent to
+        int s = 0;
+        while (s < telemetry->subscriber_count && (telemetry->subscribers[s].addr_len != from_len ||
+                                                  memcmp(&telemetry->subscribers[s].addr, &from, from_len) != 0)) {
+            s++;
+        }
+        if (unsubscribe) {
+            if (s < telemetry->subscriber_count) telemetry->subscribers[s] = telemetry->subscribers[--telemetry->subscriber_count];
+            continue;
+        }
+        if (s == telemetry->subscriber_count) {
+            if (s == TELEMETRY_MAX_SUBSCRIBERS) continue;
+            telemetry->subscribers[s].addr = from;
+            telemetry->subscribers[s].addr_len = from_len;
+            telemetry->subscriber_count++;
+        }
+        telemetry->subscribers[s].seen = now;
+    }
+    for (int s = 0; s < telemetry->subscriber_count;) {
+        if (now - telemetry->subscribers[s].seen > TELEMETRY_TIMEOUT) {
+            telemetry->subscribers[s] = telemetry->subscribers[--telemetry->subscriber_count];
+        } else {
+            s++;
+        }
+    }
+}
+
+// Send records to every subscriber, TELEMETRY_FRAMES to a datagram. Each
+// send gathers the header and the records where they lie, so frames are
+// never copied. A full socket buffer drops the datagram rather than wait.
+void telemetryPublish(struct Telemetry* telemetry, const struct LogRecord* records, int n) {
+    telemetryPoll(telemetry);
+    for (int k = 0; k < n && telemetry->subscriber_count > 0; k += TELEMETRY_FRAMES) {
+        int count = n - k < TELEMETRY_FRAMES ? n - k : TELEMETRY_FRAMES;
+        struct TelemetryHeader header = {{'A', 'P', 'M', 'T'}, TELEMETRY_VERSION, (uint16_t)count,
+                                         telemetry->sequence++, sizeof(struct LogRecord)};
+        size_t size = count * sizeof(struct LogRecord);
+        for (int s = 0; s < telemetry->subscriber_count; s++) {
+            const struct TelemetrySubscriber* subscriber = &telemetry->subscribers[s];
+#ifdef _WIN32
+            WSABUF parts[2] = {{sizeof(header), (char*)&header}, {(ULONG)size, (char*)(records + k)}};
+            DWORD sent;
+            int ok = WSASendTo(telemetry->socket, parts, 2, &sent, 0, (const struct sockaddr*)&subscriber->addr,
+                               subscriber->addr_len, NULL, NULL) == 0;
+#else
+            struct iovec parts[2] = {{&header, sizeof(header)}, {(void*)(records + k), size}};
+            struct msghdr message = {0};
+            message.msg_name = (void*)&subscriber->addr;
+            message.msg_namelen = subscriber->addr_len;
+            message.msg_iov = parts;
+            message.msg_iovlen = 2;
+            int ok = sendmsg(telemetry->socket, &message, 0) >= 0;
+#endif
+            if (ok) telemetry->frames += count;
+            else telemetry->dropped += count;
+        }
+    }
+}
+
+// Wait up to TELEMETRY_WAIT ms for count subscribers before a run starts,
+// returns 0 on timeout. Call before the log writer thread owns telemetry.
+int telemetryWait(struct Telemetry* telemetry, int count, const char* address) {
+    Uint32 start = telemetryMillis();
+    printf("Waiting for %d telemetry subscriber(s) on %s\n", count, address);
+    while (telemetry->subscriber_count < count) {
+        if (telemetryMillis() - start > TELEMETRY_WAIT) {
+            printf("ERROR: Only %d of %d telemetry subscriber(s) after %d s!\n",
+                   telemetry->subscriber_count, count, TELEMETRY_WAIT / 1000);
+            return 0;
+        }
+        SDL_Delay(10);
+        telemetryPoll(telemetry);
+    }
+    return 1;
+}
+
+// Print the counters and close the publisher
+void telemetryClose(struct Telemetry* telemetry) {
+    if (!telemetry) return;
+    printf("Telemetry: %lld frames sent, %lld dropped, %d subscriber(s) at close\n",
+           telemetry->frames, telemetry->dropped, telemetry->subscriber_count);
+    closesocket(telemetry->socket);
+    telemetryUnlink(&telemetry->addr);
+    free(telemetry);
+    telemetryCleanup();
+}
+
+volatile sig_atomic_t subscriber_stop = 0;
+
+// Ctrl+C handler for --subscribe: finish with the summary
+static void subscriberInterrupt(int signal_number) {
+    (void)signal_number;
+    subscriber_stop = 1;
+}
+
+// Reference telemetry subscriber: print or total the frames a publisher
+// streams. Usage:
+//   apm --subscribe ADDRESS [--every N] [--count N] [--flights N] [--summary]
+// Prints every Nth frame (default every one); --summary prints only the
+// totals. Stops after --count frames or --flights ended flights, or on Ctrl+C.
+int runSubscriber(int argc, char *argv[]) {
+    long long every = 1, count_limit = 0, flight_limit = 0;
+    int summary = 0;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--every") == 0 && i + 1 < argc) {
+            every = atoll(argv[++i]);
+        } else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+            count_limit = atoll(argv[++i]);
+        } else if (strcmp(argv[i], "--flights") == 0 && i + 1 < argc) {
+            flight_limit = atoll(argv[++i]);
+        } else if (strcmp(argv[i], "--summary") == 0) {
+            summary = 1;
+        } else {
+            printf("ERROR: Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (every < 1 || count_limit < 0 || flight_limit < 0) {
+        printf("ERROR: --every takes at least 1, --count and --flights at least 0!\n");
+        return 1;
+    }
+    struct sockaddr_storage publisher, local;
+    socklen_t publisher_len, local_len;
+    if (!telemetryStartup()) return 1;
+    if (!telemetryAddress(argv[2], &publisher, &publisher_len)) {
+        telemetryCleanup();
+        return 1;
+    }
+    // Listen on a free port, or on a socket file next to the publisher's
+    local = publisher;
+    local_len = publisher_len;
+    if (local.ss_family == AF_INET) ((struct sockaddr_in*)&local)->sin_port = 0;
+#ifndef _WIN32
+    else {
+        char* path = ((struct sockaddr_un*)&local)->sun_path;
+        snprintf(path + strlen(path), 16, ".%ld", (long)getpid());
+        telemetryUnlink(&local);
+    }
+#endif
+    TelemetrySocket s = telemetryBind(&local, local_len);
+    if (s == INVALID_SOCKET) {
+        printf("ERROR: Could not open a socket to subscribe to %s!\n", argv[2]);
+        telemetryCleanup();
+        return 1;
+    }
+    int buffer = 4 << 20; // room for a headless burst; the system may cap it
+    setsockopt(s, SOL_SOCKET, SO_RCVBUF, (const char*)&buffer, sizeof(buffer));
+    signal(SIGINT, subscriberInterrupt);
+
+    union {
+        struct TelemetryHeader header;
+        char bytes[TELEMETRY_DATAGRAM];
+    } datagram;
+    long long frames = 0, datagrams = 0, lost = 0, rejected = 0, flights = 0;
+    uint32_t expected = 0;
+    struct LogRecord last = {0};
+    float peak_altitude = 0, peak_speed = 0;
+    Uint32 subscribed = telemetryMillis() - TELEMETRY_KEEPALIVE;
+    Uint64 start = SDL_GetPerformanceCounter();
+    while (!subscriber_stop && (!count_limit || frames < count_limit) && (!flight_limit || flights < flight_limit)) {
+        if (telemetryMillis() - subscribed >= TELEMETRY_KEEPALIVE) {
+            sendto(s, "subscribe", 9, 0, (const struct sockaddr*)&publisher, publisher_len);
+            subscribed = telemetryMillis();
+        }
+        fd_set ready;
+        FD_ZERO(&ready);
+        FD_SET(s, &ready);
+        struct timeval wait = {0, 250000};
+        if (select((int)s + 1, &ready, NULL, NULL, &wait) <= 0) continue;
+        int n = (int)recv(s, datagram.bytes, sizeof(datagram.bytes), 0);
+        if (n < (int)sizeof(struct TelemetryHeader)) continue;
+        const struct TelemetryHeader* header = &datagram.header;
+        if (memcmp(header->magic, "APMT", 4) != 0 || header->version != TELEMETRY_VERSION ||
+            header->frame_size != sizeof(struct LogRecord) ||
+            n != (int)(sizeof(struct TelemetryHeader) + header->frame_count * sizeof(struct LogRecord))) {
+            rejected++;
+            continue;
+        }
+        if (datagrams > 0) lost += header->sequence - expected; // counters wrap together
+        expected = header->sequence + 1;
+        datagrams++;
+        for (int k = 0; k < header->frame_count; k++) {
+            memcpy(&last, datagram.bytes + sizeof(struct TelemetryHeader) + k * sizeof(struct LogRecord),
+                   sizeof(struct LogRecord));
+            frames++;
+            if (last.end) flights++;
+            if (last.data.altitude > peak_altitude) peak_altitude = last.data.altitude;
+            if (last.data.speed > peak_speed) peak_speed = last.data.speed;
+            if (!summary && (frames % every == 0 || last.end)) {
+                printf("%6d s %-8s Alt: %6.0f ft, Speed: %4.0f kt, Hdg: %3.0f, Fuel: %7.1f gal, Dist: %5.0f nm%s\n",
+                       last.time, getPhaseName(last.data.phase), last.data.altitude, last.data.speed,
+                       last.data.heading, last.data.fuel, last.data.distance_remaining, last.end ? " [END]" : "");
+            }
+            if ((count_limit && frames >= count_limit) || (flight_limit && flights >= flight_limit)) break;
+        }
+    }
+    sendto(s, "unsubscribe", 11, 0, (const struct sockaddr*)&publisher, publisher_len);
+    closesocket(s);
+    telemetryUnlink(&local);
+    telemetryCleanup();
+
+    double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    printf("Subscriber: %lld frames in %lld datagrams (%.1f per datagram), %lld datagram(s) lost, %lld rejected\n",
+           frames, datagrams, datagrams ? (double)frames / datagrams : 0.0, lost, rejected);
+    printf("Flights ended: %lld | Peak altitude: %.0f ft | Peak speed: %.0f kt | %.0f frames/s\n",
+           flights, peak_altitude, peak_speed, seconds > 0 ? frames / seconds : 0.0);
+    return 0;
+}
+
+// Get phase name
+const char* getPhaseName(int phase) {
+    switch (phase) {
+        case 0: return "Ground";
+        case 1: return "Takeoff";
+        case 2: return "Climb";
+        case 3: return "Cruise";
+        case 4: return "Descent";
+        case 5: return "Landing";
+        default: return "Unknown";
+    }
+}
+
+// Get aircraft name
+const char* getAircraftName(AircraftType type) {
+    return type >= 0 && type < aircraft_type_count ? aircraft_profiles[type].name : "Unknown";
+}
+
+// Get aircraft type code
+const char* getAircraftCode(AircraftType type) {
+    return type >= 0 && type < aircraft_type_count ? aircraft_profiles[type].code : "";
+}
+
+// FNV-1a string hash
+static unsigned int hashString(const char* text) {
+    unsigned int hash = 2166136261u;
+    for (; *text; text++) hash = (hash ^ (unsigned char)*text) * 16777619u;
+    return hash;
+}
+
+// Find airport index by code
+int findAirport(const char* code) {
+    if (!airport_grid.code_table) return -1;
+    int mask = airport_grid.code_table_size - 1;
+    for (int slot = hashString(code) & mask; airport_grid.code_table[slot]; slot = (slot + 1) & mask) {
+        int i = airport_grid.code_table[slot] - 1;
+        if (strcmp(airports[i].code, code) == 0) return i;
+    }
+    return -1;
+}
+
+// Return the pooled copy of a string, adding it on first use
+const char* internString(const char* text) {
+    if (strings.count * 2 >= strings.table_size) { // keep the hash set at most half full
+        size_t size = strings.table_size ? strings.table_size * 2 : 1024;
+        const char** table = calloc(size, sizeof(const char*));
+        if (!table) return NULL;
+        for (size_t i = 0; i < strings.table_size; i++) {
+            if (!strings.table[i]) continue;
+            size_t slot = hashString(strings.table[i]) & (size - 1);
+            while (table[slot]) slot = (slot + 1) & (size - 1);
+            table[slot] = strings.table[i];
+        }
+        free(strings.table);
+        strings.table = table;
+        strings.table_size = size;
+    }
+    size_t mask = strings.table_size - 1;
+    size_t slot = hashString(text) & mask;
+    for (; strings.table[slot]; slot = (slot + 1) & mask) {
+        if (strcmp(strings.table[slot], text) == 0) return strings.table[slot];
+    }
+    size_t length = strlen(text) + 1;
+    if (length > STRING_BLOCK - sizeof(char*)) return NULL;
+    if (!strings.block || strings.used + length > STRING_BLOCK) {
+        char* block = malloc(STRING_BLOCK);
+        if (!block) return NULL;
+        memcpy(block, &strings.block, sizeof(char*)); // chain for freeing
+        strings.block = block;
+        strings.used = sizeof(char*);
+    }
+    char* copy = strings.block + strings.used;
+    memcpy(copy, text, length);
+    strings.used += length;
+    strings.table[slot] = copy;
+    strings.count++;
+    return copy;
+}
+
+// Put airport i into an open-addressing code table of the given size
+static void insertAirportCode(int* table, int size, int i) {
+    int slot = hashString(airports[i].code) & (size - 1);
+    while (table[slot]) slot = (slot + 1) & (size - 1);
+    table[slot] = i + 1;
+}
+
+// Append an airport, interning its strings and indexing its code so
+// findAirport() sees it at once; returns its index or -1
+int addAirport(const struct Airport* airport) {
+    if (airport_count == airport_capacity) {
+        int capacity = airport_capacity ? airport_capacity * 2 : 64;
+        struct Airport* grown = realloc(airports, capacity * sizeof(struct Airport));
+        if (!grown) return -1;
+        airports = grown;
+        airport_capacity = capacity;
+    }
+    struct Airport* added = &airports[airport_count];
+    *added = *airport;
+    added->name = internString(airport->name);
+    added->code = internString(airport->code);
+    if (!added->name || !added->code) return -1;
+    if ((airport_count + 1) * 2 > airport_grid.code_table_size) { // keep the table at most half full
+        int size = airport_grid.code_table_size ? airport_grid.code_table_size * 2 : 16;
+        int* table = calloc(size, sizeof(int));
+        if (!table) return -1;
+        for (int i = 0; i < airport_count; i++) insertAirportCode(table, size, i);
+        free(airport_grid.code_table);
+        airport_grid.code_table = table;
+        airport_grid.code_table_size = size;
+    }
+    insertAirportCode(airport_grid.code_table, airport_grid.code_table_size, airport_count);
+    return airport_count++;
+}
+
+// Load the built-in route network and index it
+int initAirports(void) {
+    for (int i = 0; i < MAX_AIRPORTS; i++) {
+        if (addAirport(&builtin_airports[i]) < 0) return 0;
+    }
+    return buildAirportIndex();
+}
+
+// Load airports and waypoints from a CSV file, one per line:
+//   code,name,lat,lon[,elevation,runway_length,runway_heading,has_ils,A|W]
+// Blank lines and lines starting with # are skipped, codes already known
+// are ignored. Names must not contain commas; codes and names must fit a
+// snapshot code and a binary log header.
+int loadAirports(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        printf("ERROR: Could not open %s!\n", path);
+        return 0;
+    }
+    char line[512];
+    int line_number = 0, loaded = 0;
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+        char* fields[MAX_CSV_FIELDS] = {0};
+        int n = 0;
+        for (char* field = line; field && n < MAX_CSV_FIELDS; n++) {
+            fields[n] = field;
+            field = strchr(field, ',');
+            if (field) *field++ = '\0';
+        }
+        char* end;
+        float lat = n >= 4 ? strtof(fields[2], &end) : 0;
+        int valid = n >= 4 && end != fields[2] && lat >= -90 && lat <= 90; // false for NaN too
+        float lon = valid ? strtof(fields[3], &end) : 0;
+        if (!valid || end == fields[3] || !(lon >= -180 && lon <= 180)) {
+            printf("ERROR: %s:%d is not code,name,lat,lon,...!\n", path, line_number);
+            fclose(file);
+            return 0;
+        }
+        if (strlen(fields[0]) >= SNAPSHOT_CODE || strlen(fields[1]) >= LOG_NAME) {
+            printf("ERROR: %s:%d code must be under %d and name under %d characters!\n",
+                   path, line_number, SNAPSHOT_CODE, LOG_NAME);
+            fclose(file);
+            return 0;
+        }
+        struct Airport airport = {0};
+        airport.code = fields[0];
+        airport.name = fields[1];
+        airport.lat = lat;
+        airport.lon = lon;
+        if (n > 4) airport.elevation = strtof(fields[4], NULL);
+        if (n > 5) airport.runway_length = strtof(fields[5], NULL);
+        if (n > 6) airport.runway_heading = strtof(fields[6], NULL);
+        if (n > 7) airport.has_ils = atoi(fields[7]);
+        if (n > 8) airport.waypoint = fields[8][0] == 'W';
+        if (findAirport(airport.code) >= 0) continue;
+        if (addAirport(&airport) < 0) {
+            printf("ERROR: Out of memory loading %s!\n", path);
+            fclose(file);
+            return 0;
+        }
+        loaded++;
+    }
+    fclose(file);
+    if (!buildAirportIndex()) return 0;
+    printf("Loaded %d airports and waypoints from %s (%d total, %zu strings)\n",
+           loaded, path, airport_count, strings.count);
+    return 1;
+}
+
+// Grid cell of a position, longitude wrapped to [-180, 180)
+static int gridRow(float lat) {
+    int row = (int)floorf(lat + 90);
+    return row < 0 ? 0 : row >= GRID_ROWS ? GRID_ROWS - 1 : row;
+}
+static int gridCol(float lon) {
+    int col = (int)floorf(lon + 180) % GRID_COLS;
+    return col < 0 ? col + GRID_COLS : col;
+}
+
+// Rebuild the spatial grid (counting sort by cell); addAirport() keeps the
+// code lookup table up to date
+int buildAirportIndex(void) {
+    const int cells = GRID_ROWS * GRID_COLS;
+    int* cell_start = calloc(cells + 1, sizeof(int));
+    int* fill = malloc(cells * sizeof(int));
+    int* items = malloc((airport_count + 1) * sizeof(int));
+    if (!cell_start || !fill || !items) {
+        printf("ERROR: Out of memory building airport index!\n");
+        free(cell_start); free(fill); free(items);
+        return 0;
+    }
+    for (int i = 0; i < airport_count; i++) {
+        cell_start[gridRow(airports[i].lat) * GRID_COLS + gridCol(airports[i].lon) + 1]++;
+    }
+    for (int c = 0; c < cells; c++) cell_start[c + 1] += cell_start[c];
+    memcpy(fill, cell_start, cells * sizeof(int));
+    for (int i = 0; i < airport_count; i++) {
+        items[fill[gridRow(airports[i].lat) * GRID_COLS + gridCol(airports[i].lon)]++] = i;
+    }
+    free(fill);
+    free(airport_grid.cell_start);
+    free(airport_grid.items);
+    airport_grid.cell_start = cell_start;
+    airport_grid.items = items;
+    return 1;
+}
+
+// Airports inside a lat/lon box (lon_min > lon_max crosses the date line),
+// returns how many were written to out, at most max
+int airportsInRect(float lat_min, float lat_max, float lon_min, float lon_max, int* out, int max) {
+    int n = 0;
+    int cols = (int)ceilf(lon_max - lon_min) + 1;
+    if (lon_max < lon_min) cols += GRID_COLS;
+    if (cols > GRID_COLS) cols = GRID_COLS;
+    for (int row = gridRow(lat_min); row <= gridRow(lat_max); row++) {
+        for (int c = 0, col = gridCol(lon_min); c < cols; c++, col = (col + 1) % GRID_COLS) {
+            int cell = row * GRID_COLS + col;
+            for (int k = airport_grid.cell_start[cell]; k < airport_grid.cell_start[cell + 1]; k++) {
+                const struct Airport* a = &airports[airport_grid.items[k]];
+                int inside_lon = lon_min <= lon_max ? a->lon >= lon_min && a->lon <= lon_max
+                                                    : a->lon >= lon_min || a->lon <= lon_max;
+                if (a->lat < lat_min || a->lat > lat_max || !inside_lon) continue;
+                if (n == max) return n;
+                out[n++] = airport_grid.items[k];
+            }
+        }
+    }
+    return n;
+}
+
+// Cells on the square ring at Chebyshev distance ring from a cell, returns the count
+static int gridRing(int row0, int col0, int ring, int* cells) {
+    int n = 0;
+    for (int row = row0 - ring; row <= row0 + ring; row++) {
+        if (row < 0 || row >= GRID_ROWS) continue;
+        int edge_row = row == row0 - ring || row == row0 + ring;
+        int step = edge_row || ring == 0 ? 1 : 2 * ring; // inner rows: only the two edge columns
+        for (int dc = -ring; dc <= ring; dc += step) {
+            cells[n++] = row * GRID_COLS + ((col0 + dc) % GRID_COLS + GRID_COLS) % GRID_COLS;
+        }
+    }
+    return n;
+}
+
+// Lower bound (nm) on the distance to anything outside rings 0..ring, 60 nm per degree
+static float gridRingBound(float lat, float lon, int ring) {
+    int row0 = gridRow(lat), col0 = gridCol(lon);
+    float lat_gap = fminf(lat + 90 - (row0 - ring), row0 + ring + 1 - (lat + 90));
+    float max_lat = fminf(fabsf(lat) + ring + 1, 90);
+    float lon_gap = fminf(lon + 180 - (col0 - ring), col0 + ring + 1 - (lon + 180));
+    return fminf(lat_gap * 60, lon_gap * 60 * cosf(max_lat * PI / 180));
+}
+
+// Nearest airport or waypoint to a position: search grid rings outwards
+// until nothing outside the searched box can be closer
+int nearestAirport(float lat, float lon) {
+    int cells[8 * GRID_COLS / 2 + 1];
+    int best = -1;
+    float best_distance = 1e30f;
+    for (int ring = 0; ring <= GRID_COLS / 2; ring++) {
+        int n = gridRing(gridRow(lat), gridCol(lon), ring, cells);
+        for (int c = 0; c < n; c++) {
+            for (int k = airport_grid.cell_start[cells[c]]; k < airport_grid.cell_start[cells[c] + 1]; k++) {
+                int i = airport_grid.items[k];
+                float d = calculateDistance(lat, lon, airports[i].lat, airports[i].lon);
+                if (d < best_distance) {
+                    best_distance = d;
+                    best = i;
+                }
+            }
+        }
+        if (best >= 0 && gridRingBound(lat, lon, ring) >= best_distance) break;
+    }
+    return best;
+}
+
+// Gathered candidates awaiting scoring, query position replicated for batchDistance()
+struct DiversionBatch {
+    int n;
+    int airport[DIVERSION_BATCH];
+    float lat1[DIVERSION_BATCH], lon1[DIVERSION_BATCH];
+    float lat2[DIVERSION_BATCH], lon2[DIVERSION_BATCH];
+    float distance[DIVERSION_BATCH];
+};
+
+// Score a batch of suitable airports and merge them into the ranked top k:
+// distances are evaluated together with batchDistance(), fuel is time to
+// reach at the current airspeed plus the tailwind along the course
+static void rankDiversions(const struct DiversionQuery* query, struct DiversionBatch* batch,
+                           struct Diversion* best, int* count, int k) {
+    int n = batch->n;
+    const float* lat2 = batch->lat2;
+    const float* lon2 = batch->lon2;
+    const float* distance = batch->distance;
+    batchDistance(batch->lat1, batch->lon1, lat2, lon2, batch->distance, n);
+    batch->n = 0;
+
+    float deg = PI / 180;
+    float lat_sin = sinf(query->lat * deg), lat_cos = cosf(query->lat * deg);
+    float wind_east = query->wind_speed * sinf(query->wind_direction * deg); // blowing toward
+    float wind_north = query->wind_speed * cosf(query->wind_direction * deg);
+    for (int j = 0; j < n; j++) {
+        float dlon = (lon2[j] - query->lon) * deg;
+        float east = sinf(dlon) * cosf(lat2[j] * deg);  // initial course, unnormalized
+        float north = lat_cos * sinf(lat2[j] * deg) - lat_sin * cosf(lat2[j] * deg) * cosf(dlon);
+        float norm = sqrtf(east * east + north * north);
+        float tailwind = norm > 0 ? (wind_east * east + wind_north * north) / norm : 0;
+        float ground_speed = fmaxf(query->speed + tailwind, query->speed * 0.25f);
+        float fuel = distance[j] / ground_speed * query->perf->fuel_flow;
+        if (*count == k && fuel >= best[k - 1].fuel) continue;
+        int at = *count < k ? (*count)++ : k - 1;
+        while (at > 0 && best[at - 1].fuel > fuel) {
+            best[at] = best[at - 1];
+            at--;
+        }
+        best[at] = (struct Diversion){batch->airport[j], distance[j], fuel};
+    }
+}
+
+// The k airports nearest in fuel that suit the aircraft: runway at least
+// perf->min_runway long, an ILS when visibility is below ILS_VISIBILITY,
+// no waypoints. Rings are searched outwards until the best case fuel to
+// anything outside the searched box exceeds the k-th candidate's.
+// Returns how many were found, ranked by fuel.
+int findDiversions(const struct DiversionQuery* query, int k, struct Diversion* out) {
+    int cells[8 * GRID_COLS / 2 + 1];
+    struct DiversionBatch batch;
+    int count = 0;
+    int need_ils = query->visibility < ILS_VISIBILITY;
+    float best_speed = query->speed + query->wind_speed; // full tailwind
+    if (k > MAX_DIVERSIONS) k = MAX_DIVERSIONS;
+    if (k < 1 || query->speed <= 0) return 0;
+    batch.n = 0;
+    for (int j = 0; j < DIVERSION_BATCH; j++) {
+        batch.lat1[j] = query->lat;
+        batch.lon1[j] = query->lon;
+    }
+    // A small database fits one batch, cheaper than walking mostly empty rings
+    int small = airport_count <= DIVERSION_BATCH;
+    for (int ring = 0; ring <= GRID_COLS / 2; ring++) {
+        int cell_count = small ? 1 : gridRing(gridRow(query->lat), gridCol(query->lon), ring, cells);
+        for (int c = 0; c < cell_count; c++) {
+            int begin = small ? 0 : airport_grid.cell_start[cells[c]];
+            int end = small ? airport_count : airport_grid.cell_start[cells[c] + 1];
+            for (int j = begin; j < end; j++) {
+                int i = small ? j : airport_grid.items[j];
+                const struct Airport* a = &airports[i];
+                if (a->waypoint || a->runway_length < query->perf->min_runway || (need_ils && !a->has_ils)) continue;
+                batch.airport[batch.n] = i;
+                batch.lat2[batch.n] = a->lat;
+                batch.lon2[batch.n] = a->lon;
+                if (++batch.n == DIVERSION_BATCH) rankDiversions(query, &batch, out, &count, k);
+            }
+        }
+        if (batch.n > 0) rankDiversions(query, &batch, out, &count, k);
+        if (small) break;
+        float bound = gridRingBound(query->lat, query->lon, ring) / best_speed * query->perf->fuel_flow;
+        if (count == k && bound >= out[k - 1].fuel) break;
+    }
+    return count;
+}
+
+// Diversion queries for fleet aircraft [begin, end), k results per
+// aircraft written to out[(i - begin) * k], counts to found[i - begin]
+void fleetFindDiversions(const struct Fleet* fleet, int begin, int end, float visibility,
+                         int k, struct Diversion* out, int* found) {
+    for (int i = begin; i < end; i++) {
+        struct DiversionQuery query = {
+            fleet->lat[i], fleet->lon[i], fmaxf(fleet->true_airspeed[i], fleet->perf[fleet->type[i]].stall_speed),
+            fleet->wind_speed[i], fleet->wind_direction[i], visibility, &fleet->perf[fleet->type[i]]
+        };
+        found[i - begin] = findDiversions(&query, k, out + (size_t)(i - begin) * k);
+    }
+}
+
+// Counter-based random number: a hash of (seed, stream, counter), so every
+// draw is reproducible no matter which thread or in which order it is made
+unsigned int rngCounter(unsigned int seed, unsigned int stream, unsigned int counter) {
+    uint64_t x = ((uint64_t)seed << 32 | stream) + (uint64_t)counter * 0x9E3779B97F4A7C15ULL;
+    x ^= x >> 30; x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27; x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return (unsigned int)(x >> 32);
+}
+
+// Uniform random number in [0, 1) from the counter-based generator
+float rngUniform(unsigned int seed, unsigned int stream, unsigned int counter) {
+    return (rngCounter(seed, stream, counter) >> 8) * (1.0f / 16777216.0f);
+}
+
+// Standard normal random number (Box-Muller), uses counters counter and counter + 1
+float rngNormal(unsigned int seed, unsigned int stream, unsigned int counter) {
+    float u1 = 1.0f - rngUniform(seed, stream, counter); // (0, 1]
+    float u2 = rngUniform(seed, stream, counter + 1);
+    return sqrtf(-2.0f * logf(u1)) * cosf(2.0f * (float)PI * u2);
+}
+
+// Calculate distance
+float calculateDistance(float lat1, float lon1, float lat2, float lon2) {
+    float dlat = (lat2 - lat1) * PI / 180.0;
+    float dlon = (lon2 - lon1) * PI / 180.0;
+    lat1 *= PI / 180.0; lat2 *= PI / 180.0;
+    float a = sin(dlat / 2) * sin(dlat / 2) + cos(lat1) * cos(lat2) * sin(dlon / 2) * sin(dlon / 2);
     float c = 2 * atan2(sqrt(a), sqrt(1 - a));
     return 3440.0 * c;
 }
 
-// Main function
-int main(int argc, char *argv[]) {
-    srand(time(NULL));
-    FILE* log = fopen("flight_log.txt", "w");
-    if (!log) {
-        printf("ERROR: Could not open flight_log.txt!\n");
+// Precompute the great-circle distance of every airport pair
+void buildRouteMatrix(void) {
+    for (int i = 0; i < MAX_AIRPORTS; i++) {
+        for (int j = 0; j < MAX_AIRPORTS; j++) {
+            route_distance[i][j] = i == j ? 0 : calculateDistance(airports[i].lat, airports[i].lon,
+                                                                  airports[j].lat, airports[j].lon);
+        }
+    }
+    route_matrix_built = 1;
+}
+
+// Distance between two airports, from the pair matrix for the route network
+float routeDistance(int dep, int dest) {
+    if (dep >= MAX_AIRPORTS || dest >= MAX_AIRPORTS) {
+        return calculateDistance(airports[dep].lat, airports[dep].lon, airports[dest].lat, airports[dest].lon);
+    }
+    if (!route_matrix_built) buildRouteMatrix();
+    return route_distance[dep][dest];
+}
+
+// Point a fraction f of the way along the great circle between two positions
+static void greatCirclePoint(float lat1, float lon1, float lat2, float lon2, float f,
+                             float* lat, float* lon) {
+    double deg = PI / 180.0;
+    double x1 = cos(lat1 * deg) * cos(lon1 * deg), y1 = cos(lat1 * deg) * sin(lon1 * deg), z1 = sin(lat1 * deg);
+    double x2 = cos(lat2 * deg) * cos(lon2 * deg), y2 = cos(lat2 * deg) * sin(lon2 * deg), z2 = sin(lat2 * deg);
+    double angle = acos(fmin(fmax(x1 * x2 + y1 * y2 + z1 * z2, -1.0), 1.0));
+    if (angle < 1e-9) {
+        *lat = lat1;
+        *lon = lon1;
+        return;
+    }
+    double a = sin((1 - f) * angle) / sin(angle), b = sin(f * angle) / sin(angle);
+    double x = a * x1 + b * x2, y = a * y1 + b * y2, z = a * z1 + b * z2;
+    *lat = atan2(z, sqrt(x * x + y * y)) / deg;
+    *lon = atan2(y, x) / deg;
+}
+
+// Append legs along the great circle between two points, distance apart,
+// ending at airport fix. Returns 0 if they do not fit in the plan.
+static int appendLegs(struct FlightPlan* plan, float lat1, float lon1, float lat2, float lon2,
+                      float distance, int fix) {
+    int pieces = (int)ceilf(distance / LEG_MAX_LENGTH);
+    if (pieces < 1) pieces = 1;
+    if (plan->leg_count + pieces > MAX_PLAN_LEGS) return 0;
+    for (int p = 0; p < pieces; p++) {
+        struct FlightLeg* leg = &plan->legs[plan->leg_count++];
+        float end_lat, end_lon;
+        greatCirclePoint(lat1, lon1, lat2, lon2, (float)p / pieces, &leg->lat, &leg->lon);
+        greatCirclePoint(lat1, lon1, lat2, lon2, (float)(p + 1) / pieces, &end_lat, &end_lon);
+        float from_lat = leg->lat * PI / 180.0, to_lat = end_lat * PI / 180.0;
+        float dlon = (end_lon - leg->lon) * PI / 180.0;
+        leg->course = atan2(sin(dlon) * cos(to_lat), cos(from_lat) * sin(to_lat) - sin(from_lat) * cos(to_lat) * cos(dlon)) * 180.0 / PI;
+        if (leg->course < 0) leg->course += 360;
+        leg->course_sin = sin(leg->course * PI / 180.0);
+        leg->course_cos = cos(leg->course * PI / 180.0);
+        leg->length = distance / pieces;
+        leg->fix = fix;
+    }
+    return 1;
+}
+
+// Fill in the distance to go after each leg and the plan total
+static void finishPlan(struct FlightPlan* plan) {
+    for (int i = plan->leg_count - 2; i >= 0; i--) {
+        plan->legs[i].remaining = plan->legs[i + 1].remaining + plan->legs[i + 1].length;
+    }
+    plan->total = plan->legs[0].remaining + plan->legs[0].length;
+}
+
+// Build the leg table from departure over the via fixes to destination.
+// Each great circle is cut into legs of at most LEG_MAX_LENGTH so they can
+// be flown as straight lines; course and length are computed here once.
+// Returns 0 if the route needs more than MAX_PLAN_LEGS legs.
+int buildFlightPlan(struct FlightPlan* plan, int dep, const int* via, int via_count, int dest) {
+    int fixes[MAX_WAYPOINTS + 2];
+    int fix_count = 0;
+    fixes[fix_count++] = dep;
+    for (int i = 0; i < via_count; i++) fixes[fix_count++] = via[i];
+    fixes[fix_count++] = dest;
+
+    memset(plan, 0, sizeof(*plan));
+    for (int f = 0; f + 1 < fix_count; f++) {
+        const struct Airport* from = &airports[fixes[f]];
+        const struct Airport* to = &airports[fixes[f + 1]];
+        float distance = via_count == 0 ? routeDistance(dep, dest)
+                                        : calculateDistance(from->lat, from->lon, to->lat, to->lon);
+        if (!appendLegs(plan, from->lat, from->lon, to->lat, to->lon, distance, fixes[f + 1])) {
+            plan->leg_count = 0;
+            return 0;
+        }
+    }
+    finishPlan(plan);
+    return 1;
+}
+
+// Build a direct leg table from a position to an airport, for diversions
+int buildDirectPlan(struct FlightPlan* plan, float lat, float lon, int dest) {
+    memset(plan, 0, sizeof(*plan));
+    float distance = calculateDistance(lat, lon, airports[dest].lat, airports[dest].lon);
+    if (!appendLegs(plan, lat, lon, airports[dest].lat, airports[dest].lon, distance, dest)) {
+        plan->leg_count = 0;
+        return 0;
+    }
+    finishPlan(plan);
+    return 1;
+}
+
+// Send an aircraft onto a new plan from where it is now. An aircraft
+// already descending resumes cruise if the new destination is further
+// than the top of descent.
+void divertAircraft(struct FlightData* aircraft, const struct FlightPlan* plan) {
+    aircraft->leg = 0;
+    aircraft->along_track = 0;
+    aircraft->cross_track = 0;
+    aircraft->distance_remaining = plan->total;
+    if (aircraft->phase == 4 && plan->total >= DESCENT_DISTANCE) {
+        aircraft->phase = 3;
+        aircraft->flaps = 0;
+    }
+}
+
+// Parse a comma separated list of airport or waypoint codes into route_via,
+// returns 0 on an unknown code or too many fixes
+int parseVia(const char* list) {
+    char code[16];
+    route_via_count = 0;
+    while (*list) {
+        size_t n = strcspn(list, ",");
+        if (n == 0 || n >= sizeof(code) || route_via_count == MAX_WAYPOINTS) return 0;
+        memcpy(code, list, n);
+        code[n] = '\0';
+        int fix = findAirport(code);
+        if (fix < 0) {
+            printf("ERROR: Unknown waypoint %s!\n", code);
+            return 0;
+        }
+        route_via[route_via_count++] = fix;
+        list += n;
+        if (*list == ',') list++;
+    }
+    return 1;
+}
+
+// Allocate fleet columns in one aligned block
+int fleetAlloc(struct Fleet* fleet, int capacity) {
+    int columns = 0;
+#define X(name) columns++;
+    FLEET_FLOAT_COLUMNS(X)
+    FLEET_INT_COLUMNS(X)
+#undef X
+    *fleet = (struct Fleet){0};
+    fleet->capacity = (capacity + 15) & ~15;
+    size_t column_bytes = ((size_t)fleet->capacity * 4 + FLEET_ALIGN - 1) & ~(size_t)(FLEET_ALIGN - 1);
+    fleet->block = calloc(1, column_bytes * columns + FLEET_ALIGN);
+    if (!fleet->block) return 0;
+
+    char* next = (char*)(((size_t)fleet->block + FLEET_ALIGN - 1) & ~(size_t)(FLEET_ALIGN - 1));
+#define X(name) fleet->name = (void*)next; next += column_bytes;
+    FLEET_FLOAT_COLUMNS(X)
+    FLEET_INT_COLUMNS(X)
+#undef X
+    fleet->perf = malloc(sizeof(struct AircraftPerformance) * aircraft_type_count);
+    if (!fleet->perf) {
+        free(fleet->block);
+        return 0;
+    }
+    for (int t = 0; t < aircraft_type_count; t++) {
+        fleet->perf[t] = aircraft_profiles[t].perf;
+    }
+    fleet->tick = 1;
+    fleet->substeps = 1;
+    return 1;
+}
+
+// Free fleet columns
+void fleetFree(struct Fleet* fleet) {
+    free(fleet->block);
+    free(fleet->perf);
+    free(fleet->plans);
+    *fleet = (struct Fleet){0};
+}
+
+// Add an aircraft flying a plan (NULL: hold heading) to the fleet, returns
+// its index or -1 when full. Aircraft added in a row on the same plan share it.
+int fleetAddAircraft(struct Fleet* fleet, const struct FlightData* aircraft, const struct Weather* weather,
+                     const struct FlightPlan* plan) {
+    if (fleet->count >= fleet->capacity) return -1;
+    int plan_index = -1;
+    if (plan && plan->leg_count > 0) {
+        if (fleet->plan_count == 0 || memcmp(&fleet->plans[fleet->plan_count - 1], plan, sizeof(*plan)) != 0) {
+            if (fleet->plan_count == fleet->plan_capacity) {
+                int capacity = fleet->plan_capacity ? fleet->plan_capacity * 2 : 4;
+                struct FlightPlan* plans = realloc(fleet->plans, sizeof(struct FlightPlan) * capacity);
+                if (!plans) return -1;
+                fleet->plans = plans;
+                fleet->plan_capacity = capacity;
+            }
+            fleet->plans[fleet->plan_count++] = *plan;
+        }
+        plan_index = fleet->plan_count - 1;
+    }
+    int i = fleet->count++;
+#define X(name) fleet->name[i] = aircraft->name;
+    X(altitude) X(speed) X(fuel) X(throttle) X(heading) X(bank_angle)
+    X(turn_radius) X(distance_remaining) X(vertical_speed) X(ground_speed)
+    X(true_airspeed) X(indicated_airspeed) X(mach_number) X(g_force)
+    X(temperature) X(pressure) X(density_altitude) X(lat) X(lon)
+    X(prev_altitude) X(phase) X(flaps) X(gear) X(autopilot) X(transponder)
+    X(type) X(leg) X(along_track) X(cross_track)
+#undef X
+    fleet->wind_speed[i] = weather->wind_speed;
+    fleet->wind_direction[i] = weather->wind_direction;
+    fleet->air_temperature[i] = weather->temperature;
+    fleet->air_pressure[i] = weather->pressure;
+    fleet->flight_time[i] = 0;
+    fleet->warnings[i] = 0;
+    fleet->active[i] = 1;
+    fleet->rng_stream[i] = i;
+    fleet->plan[i] = plan_index;
+    const struct FlightLeg* leg = plan_index >= 0 ? &fleet->plans[plan_index].legs[aircraft->leg] : NULL;
+    fleet->course_sin[i] = leg ? leg->course_sin : 0;
+    fleet->course_cos[i] = leg ? leg->course_cos : 0;
+    return i;
+}
+
+// Add a branch of a snapshot to the fleet, returns its index or -1 when
+// full. The fleet's seed, tick and substeps must match the snapshot's for
+// the branch to carry on where the snapshot left off.
+int fleetAddSnapshot(struct Fleet* fleet, const struct Snapshot* snapshot) {
+    int i = fleetAddAircraft(fleet, &snapshot->plane, &snapshot->weather, &snapshot->plan);
+    if (i < 0) return -1;
+    fleet->flight_time[i] = snapshot->flight_time;
+    fleet->warnings[i] = snapshot->warning_count;
+    return i;
+}
+
+// Copy one aircraft out of the fleet
+void fleetLoad(const struct Fleet* fleet, int i, struct FlightData* aircraft) {
+#define X(name) aircraft->name = fleet->name[i];
+    X(altitude) X(speed) X(fuel) X(throttle) X(heading) X(bank_angle)
+    X(turn_radius) X(distance_remaining) X(vertical_speed) X(ground_speed)
+    X(true_airspeed) X(indicated_airspeed) X(mach_number) X(g_force)
+    X(temperature) X(pressure) X(density_altitude) X(lat) X(lon)
+    X(prev_altitude) X(phase) X(flaps) X(gear) X(autopilot) X(transponder)
+    X(leg) X(along_track) X(cross_track)
+#undef X
+    aircraft->type = (AircraftType)fleet->type[i];
+}
+
+// Fleet version of updateFlight()
+void fleetUpdateFlight(struct Fleet* fleet, int begin, int end, float dt) {
+    const double speed_lag = lagFactor(0.05, dt);
+    const double altitude_lag = lagFactor(0.1, dt);
+    for (int i = begin; i < end; i++) {
+        if (!fleet->active[i]) continue;
+        float speed = fleet->speed[i];
+        float altitude = fleet->altitude[i];
+        float fuel = fleet->fuel[i];
+        flightPhaseStep(&speed, &altitude, &fuel, &fleet->phase[i], &fleet->flaps[i], &fleet->gear[i],
+                        fleet->throttle[i], fleet->distance_remaining[i], dt, speed_lag, altitude_lag);
+        fleet->speed[i] = speed;
+        fleet->altitude[i] = altitude;
+        fleet->fuel[i] = fuel;
+    }
+}
+
+#ifdef SIMD_LANES
+// Vector isaLookup(): one gather per table row pair
+static inline vfloat visaLookup(const float* column, vfloat altitude) {
+    vfloat x = vmul(vsub(altitude, vset(ISA_FLOOR)), vset(1 / ISA_STEP));
+    x = vmin(vmax(x, vset(0.0f)), vset(ISA_ROWS - 1));
+    vint i = vtrunc(x);
+    vfloat low = vgather(column, i);
+    vfloat high = vgather(column + 1, i);
+    return vadd(low, vmul(vsub(high, low), vsub(x, vtofloat(i))));
+}
+#endif
+
+// Aerodynamics for fleet aircraft [begin, end): with fixed set every
+// aircraft is that profile, otherwise each looks up its own type. Inlined
+// with a constant profile, the performance reads become constants.
+static inline void aerodynamicsKernel(struct Fleet* fleet, int begin, int end,
+                                      const struct AircraftPerformance* fixed) {
+    const float cl = 1.0;
+    const float wing_area = 174.0;
+    int i = begin;
+#ifdef SIMD_LANES
+    const int stride = sizeof(struct AircraftPerformance) / sizeof(float);
+    for (; i + SIMD_LANES <= end; i += SIMD_LANES) {
+        vfloat parked = vieq(vloadi(fleet->active + i), viset(0));
+        vfloat altitude = vload(fleet->altitude + i);
+        vfloat v = vmul(vload(fleet->true_airspeed + i), vset(1.68781f));
+        vfloat q = vmul(vmul(vset(0.5f * 0.002377f), visaLookup(isa.density_ratio, altitude)), vmul(v, v));
+        vfloat lift = vmul(q, vset(cl * wing_area));
+        vfloat empty_weight = fixed ? vset(fixed->empty_weight)
+                                    : vgather(&fleet->perf->empty_weight,
+                                              vtoint(vmul(vtofloat(vloadi(fleet->type + i)), vset(stride))));
+        vfloat g_force = vdiv(lift, vmul(empty_weight, vset(GRAVITY)));
+        vfloat density_altitude = vadd(altitude, vmul(vsub(vset(1013.25f), vload(fleet->pressure + i)), vset(30.0f)));
+        vstore(fleet->g_force + i, vselect(parked, vload(fleet->g_force + i), g_force));
+        vstore(fleet->density_altitude + i, vselect(parked, vload(fleet->density_altitude + i), density_altitude));
+    }
+#endif
+    for (; i < end; i++) {
+        if (!fleet->active[i]) continue;
+        const struct AircraftPerformance* p = fixed ? fixed : &fleet->perf[fleet->type[i]];
+        float density_ratio = isaLookup(isa.density_ratio, fleet->altitude[i]);
+        float v = fleet->true_airspeed[i] * 1.68781;
+        float q = 0.5 * 0.002377 * density_ratio * v * v;
+        float lift = q * cl * wing_area;
+        fleet->g_force[i] = lift / (p->empty_weight * GRAVITY);
+        fleet->density_altitude[i] = fleet->altitude[i] + (1013.25 - fleet->pressure[i]) * 30;
+    }
+}
+
+// Fleet version of calculateAerodynamics()
+void fleetCalculateAerodynamics(struct Fleet* fleet, int begin, int end) {
+    aerodynamicsKernel(fleet, begin, end, NULL);
+}
+
+#ifdef SIMD_LANES
+// Vector sine and cosine (radians): Cody-Waite reduction to [-pi/4, pi/4]
+// and the Cephes single precision polynomials, max error ~2 ulp for |x| < 8192
+static inline void vsincos(vfloat x, vfloat* s, vfloat* c) {
+    vint q = vtoint(vmul(x, vset(0.63661977236f))); // round(x * 2/pi)
+    vfloat y = vtofloat(q);
+    x = vsub(x, vmul(y, vset(1.5703125f)));
+    x = vsub(x, vmul(y, vset(4.837512969970703125e-4f)));
+    x = vsub(x, vmul(y, vset(7.54978995489188216e-8f)));
+    vfloat z = vmul(x, x);
+    vfloat sp = vadd(vmul(vadd(vmul(vset(-1.9515295891e-4f), z), vset(8.3321608736e-3f)), z), vset(-1.6666654611e-1f));
+    sp = vadd(vmul(vmul(sp, z), x), x);
+    vfloat cp = vadd(vmul(vadd(vmul(vset(2.443315711809948e-5f), z), vset(-1.388731625493765e-3f)), z), vset(4.166664568298827e-2f));
+    cp = vadd(vsub(vmul(vmul(cp, z), z), vmul(z, vset(0.5f))), vset(1.0f));
+    vfloat swap = vieq(viand(q, viset(1)), viset(1));
+    vfloat sin_sign = vieq(viand(q, viset(2)), viset(2));
+    vfloat cos_sign = vieq(viand(viadd(q, viset(1)), viset(2)), viset(2));
+    vfloat neg = vset(-0.0f);
+    *s = vxor(vselect(swap, cp, sp), vselect(sin_sign, neg, vset(0.0f)));
+    *c = vxor(vselect(swap, sp, cp), vselect(cos_sign, neg, vset(0.0f)));
+}
+
+// Vector atan2, Cephes atanf polynomial after octant reduction, max error ~2e-7 rad
+static inline vfloat vatan2(vfloat y, vfloat x) {
+    vfloat neg = vset(-0.0f);
+    vfloat ax = vandnot(neg, x);
+    vfloat ay = vandnot(neg, y);
+    vfloat big = vmax(ax, ay);
+    vfloat t = vdiv(vmin(ax, ay), vmax(big, vset(1e-30f)));
+    vfloat reduce = vgt(t, vset(0.4142135623730950f)); // tan(pi/8)
+    t = vselect(reduce, vdiv(vsub(t, vset(1.0f)), vadd(t, vset(1.0f))), t);
+    vfloat z = vmul(t, t);
+    vfloat r = vsub(vmul(vadd(vmul(vsub(vmul(vset(8.05374449538e-2f), z), vset(1.38776856032e-1f)), z),
+                              vset(1.99777106478e-1f)), z), vset(3.33329491539e-1f));
+    r = vadd(vmul(vmul(r, z), t), t);
+    r = vadd(r, vselect(reduce, vset(0.78539816339f), vset(0.0f)));
+    r = vselect(vgt(ay, ax), vsub(vset(1.57079632679f), r), r);
+    r = vselect(vlt(x, vset(0.0f)), vsub(vset(3.14159265359f), r), r);
+    return vxor(r, vand(neg, y)); // copy sign of y
+}
+
+// Vector weatherBlend(): gathers the cell corners of every lane from the
+// tile cache arena
+static inline vfloat vweatherBlend(const float* tiles, vint corner, vfloat fx, vfloat fy, vfloat fz) {
+    vfloat p00 = vgather(tiles, corner);
+    vfloat p01 = vgather(tiles + WEATHER_ROW, corner);
+    vfloat p10 = vgather(tiles + WEATHER_LEVEL, corner);
+    vfloat p11 = vgather(tiles + WEATHER_LEVEL + WEATHER_ROW, corner);
+    vfloat c00 = vadd(p00, vmul(vsub(vgather(tiles + WEATHER_FIELDS, corner), p00), fx));
+    vfloat c01 = vadd(p01, vmul(vsub(vgather(tiles + WEATHER_ROW + WEATHER_FIELDS, corner), p01), fx));
+    vfloat c10 = vadd(p10, vmul(vsub(vgather(tiles + WEATHER_LEVEL + WEATHER_FIELDS, corner), p10), fx));
+    vfloat c11 = vadd(p11, vmul(vsub(vgather(tiles + WEATHER_LEVEL + WEATHER_ROW + WEATHER_FIELDS, corner), p11), fx));
+    vfloat c0 = vadd(c00, vmul(vsub(c01, c00), fy));
+    vfloat c1 = vadd(c10, vmul(vsub(c11, c10), fy));
+    return vadd(c0, vmul(vsub(c1, c0), fz));
+}
+
+// Vector weatherSample() for fleet aircraft [i, i + SIMD_LANES): the tile
+// lookups are per aircraft, the interpolation is across the vector
+static inline void vweatherSample(struct Fleet* fleet, int i, float time, int worker, vfloat* out) {
+    struct WeatherCache* cache = weather_grid->cache[worker];
+    int corner[2][SIMD_LANES];
+    float weight[4][SIMD_LANES];
+    for (int k = 0; k < SIMD_LANES; k++) {
+        int c[2];
+        float w[4];
+        weatherLocate(weather_grid, cache, fleet->lat[i + k], fleet->lon[i + k], fleet->altitude[i + k],
+                      fleet->flight_time[i + k] + time, c, w);
+        corner[0][k] = c[0];
+        corner[1][k] = c[1];
+        for (int d = 0; d < 4; d++) weight[d][k] = w[d];
+    }
+    vfloat fx = vload(weight[0]), fy = vload(weight[1]), fz = vload(weight[2]), ft = vload(weight[3]);
+    vint now = vloadi(corner[0]), next = vloadi(corner[1]);
+    for (int f = 0; f < WEATHER_FIELDS; f++) {
+        vfloat a = vweatherBlend(cache->tiles + f, now, fx, fy, fz);
+        vfloat b = vweatherBlend(cache->tiles + f, next, fx, fy, fz);
+        out[f] = vadd(a, vmul(vsub(b, a), ft));
+    }
+}
+#endif
+
+// Fleet version of calculateWindEffect(); time is seconds into the tick
+// and worker picks the weather tile cache
+void fleetCalculateWindEffect(struct Fleet* fleet, int begin, int end, float time, int worker) {
+    int i = begin;
+#ifdef SIMD_LANES
+    const vfloat deg = vset((float)(PI / 180.0));
+    for (; i + SIMD_LANES <= end; i += SIMD_LANES) {
+        vfloat parked = vieq(vloadi(fleet->active + i), viset(0));
+        vfloat speed = vload(fleet->speed + i);
+        vfloat wind_x, wind_y, heading_sin, heading_cos;
+        if (weather_grid) {
+            vfloat sample[WEATHER_FIELDS];
+            vweatherSample(fleet, i, time, worker, sample);
+            wind_x = sample[0];
+            wind_y = sample[1];
+            vfloat direction = vmul(vatan2(wind_x, wind_y), vset((float)(180.0 / PI)));
+            direction = vselect(vlt(direction, vset(0.0f)), vadd(direction, vset(360.0f)), direction);
+            vfloat wind_speed = vsqrt(vadd(vmul(wind_x, wind_x), vmul(wind_y, wind_y)));
+            vstore(fleet->wind_speed + i, vselect(parked, vload(fleet->wind_speed + i), wind_speed));
+            vstore(fleet->wind_direction + i, vselect(parked, vload(fleet->wind_direction + i), direction));
+            vstore(fleet->air_temperature + i, vselect(parked, vload(fleet->air_temperature + i), sample[2]));
+        } else {
+            vfloat wind_speed = vload(fleet->wind_speed + i);
+            vfloat wind_sin, wind_cos;
+            vsincos(vmul(vload(fleet->wind_direction + i), deg), &wind_sin, &wind_cos);
+            wind_x = vmul(wind_speed, wind_sin);
+            wind_y = vmul(wind_speed, wind_cos);
+        }
+        vsincos(vmul(vload(fleet->heading + i), deg), &heading_sin, &heading_cos);
+        vfloat ground_x = vadd(vmul(speed, heading_sin), wind_x);
+        vfloat ground_y = vadd(vmul(speed, heading_cos), wind_y);
+        vfloat ground_speed = vsqrt(vadd(vmul(ground_x, ground_x), vmul(ground_y, ground_y)));
+        vfloat altitude = vload(fleet->altitude + i);
+        vfloat ias = vmul(speed, visaLookup(isa.density_sqrt, altitude));
+        vfloat mach = vdiv(speed, visaLookup(isa.sound_speed, altitude));
+        vstore(fleet->ground_speed + i, vselect(parked, vload(fleet->ground_speed + i), ground_speed));
+        vstore(fleet->true_airspeed + i, vselect(parked, vload(fleet->true_airspeed + i), speed));
+        vstore(fleet->indicated_airspeed + i, vselect(parked, vload(fleet->indicated_airspeed + i), ias));
+        vstore(fleet->mach_number + i, vselect(parked, vload(fleet->mach_number + i), mach));
+    }
+#endif
+    for (; i < end; i++) {
+        if (!fleet->active[i]) continue;
+        float wind_x, wind_y;
+        if (weather_grid) {
+            float sample[WEATHER_FIELDS];
+            weatherSample(worker, fleet->lat[i], fleet->lon[i], fleet->altitude[i], fleet->flight_time[i] + time, sample);
+            wind_x = sample[0];
+            wind_y = sample[1];
+            fleet->wind_speed[i] = sqrt(wind_x * wind_x + wind_y * wind_y);
+            fleet->wind_direction[i] = fmod(atan2(wind_x, wind_y) * 180.0 / PI + 360.0, 360.0);
+            fleet->air_temperature[i] = sample[2];
+        } else {
+            wind_x = fleet->wind_speed[i] * sin(fleet->wind_direction[i] * PI / 180.0);
+            wind_y = fleet->wind_speed[i] * cos(fleet->wind_direction[i] * PI / 180.0);
+        }
+        float aircraft_x = fleet->speed[i] * sin(fleet->heading[i] * PI / 180.0);
+        float aircraft_y = fleet->speed[i] * cos(fleet->heading[i] * PI / 180.0);
+        float ground_x = aircraft_x + wind_x;
+        float ground_y = aircraft_y + wind_y;
+        fleet->ground_speed[i] = sqrt(ground_x * ground_x + ground_y * ground_y);
+        fleet->true_airspeed[i] = fleet->speed[i];
+        fleet->indicated_airspeed[i] = fleet->true_airspeed[i] * isaLookup(isa.density_sqrt, fleet->altitude[i]);
+        fleet->mach_number[i] = fleet->true_airspeed[i] / isaLookup(isa.sound_speed, fleet->altitude[i]);
+    }
+}
+
+// Fleet version of updateNavigation()
+void fleetUpdateNavigation(struct Fleet* fleet, int begin, int end, float dt) {
+    int i = begin;
+#ifdef SIMD_LANES
+    const vfloat deg = vset((float)(PI / 180.0));
+    const vfloat step = vset(dt);
+    for (; i + SIMD_LANES <= end; i += SIMD_LANES) {
+        vfloat parked = vieq(vloadi(fleet->active + i), viset(0));
+        vfloat lat = vload(fleet->lat + i);
+        vfloat lon = vload(fleet->lon + i);
+        vfloat distance_nm = vdiv(vmul(vload(fleet->ground_speed + i), step), vset(3600.0f));
+        vfloat heading_sin, heading_cos, lat_sin, lat_cos;
+        vsincos(vmul(vload(fleet->heading + i), deg), &heading_sin, &heading_cos);
+        vsincos(vmul(lat, deg), &lat_sin, &lat_cos);
+        vfloat new_lat = vadd(lat, vdiv(vmul(distance_nm, heading_cos), vset(60.0f)));
+        vfloat new_lon = vadd(lon, vdiv(vmul(distance_nm, heading_sin), vmul(vset(60.0f), lat_cos)));
+        vstore(fleet->lat + i, vselect(parked, lat, new_lat));
+        vstore(fleet->lon + i, vselect(parked, lon, new_lon));
+        // Leg tracking from the same displacement; no plan means zero course terms
+        vfloat course_sin = vload(fleet->course_sin + i);
+        vfloat course_cos = vload(fleet->course_cos + i);
+        vfloat along = vload(fleet->along_track + i);
+        vfloat cross = vload(fleet->cross_track + i);
+        vfloat new_along = vadd(along, vmul(distance_nm, vadd(vmul(heading_cos, course_cos),
+                                                              vmul(heading_sin, course_sin))));
+        vfloat new_cross = vadd(cross, vmul(distance_nm, vsub(vmul(heading_sin, course_cos),
+                                                              vmul(heading_cos, course_sin))));
+        vstore(fleet->along_track + i, vselect(parked, along, new_along));
+        vstore(fleet->cross_track + i, vselect(parked, cross, new_cross));
+    }
+#endif
+    for (; i < end; i++) {
+        if (!fleet->active[i]) continue;
+        float lat_rad = fleet->lat[i] * PI / 180.0;
+        float distance_nm = fleet->ground_speed[i] * dt / 3600.0;
+        float heading_rad = fleet->heading[i] * PI / 180.0;
+        fleet->lat[i] += (distance_nm * cos(heading_rad)) / 60.0;
+        fleet->lon[i] += (distance_nm * sin(heading_rad)) / (60.0 * cos(lat_rad));
+        fleet->along_track[i] += distance_nm * (cos(heading_rad) * fleet->course_cos[i] +
+                                                sin(heading_rad) * fleet->course_sin[i]);
+        fleet->cross_track[i] += distance_nm * (sin(heading_rad) * fleet->course_cos[i] -
+                                                cos(heading_rad) * fleet->course_sin[i]);
+    }
+
+    // Leg sequencing and steering, as in updateNavigation()
+    for (i = begin; i < end; i++) {
+        if (!fleet->active[i] || fleet->plan[i] < 0) continue;
+        const struct FlightPlan* plan = &fleet->plans[fleet->plan[i]];
+        const struct FlightLeg* leg = &plan->legs[fleet->leg[i]];
+        float along = fleet->along_track[i];
+        float cross = fleet->cross_track[i];
+        while (along >= leg->length && fleet->leg[i] < plan->leg_count - 1) {
+            leg = &plan->legs[++fleet->leg[i]];
+            legOffset(leg, fleet->lat[i], fleet->lon[i], &along, &cross);
+        }
+        fleet->course_sin[i] = leg->course_sin;
+        fleet->course_cos[i] = leg->course_cos;
+        fleet->along_track[i] = along;
+        fleet->cross_track[i] = cross;
+        fleet->distance_remaining[i] = leg->remaining + leg->length - along;
+        if (fleet->phase[i] >= 2) fleet->heading[i] = legSteer(leg, cross, fleet->heading[i], dt);
+    }
+}
+
+// Envelope check for fleet aircraft [begin, end), fixed as for
+// aerodynamicsKernel()
+static inline void envelopeKernel(struct Fleet* fleet, int begin, int end,
+                                  const struct AircraftPerformance* fixed) {
+    for (int i = begin; i < end; i++) {
+        if (!fleet->active[i]) continue;
+        const struct AircraftPerformance* p = fixed ? fixed : &fleet->perf[fleet->type[i]];
+        int warnings = 0;
+        if (fleet->speed[i] > p->vne) {
+            warnings++;
+            fleet->speed[i] = p->vne;
+        }
+        if (fleet->speed[i] < p->stall_speed) {
+            warnings++;
+            fleet->speed[i] = p->stall_speed;
+        }
+        if (fleet->altitude[i] > p->max_altitude) {
+            warnings++;
+            fleet->altitude[i] = p->max_altitude;
+        }
+        if (fleet->altitude[i] < MIN_ALTITUDE) {
+            warnings++;
+            fleet->altitude[i] = MIN_ALTITUDE;
+        }
+        if (fleet->g_force[i] > 2.5) warnings++;
+        fleet->warnings[i] += warnings;
+    }
+}
+
+// Fleet version of checkFlightEnvelope(), warnings are counted per aircraft
+void fleetCheckFlightEnvelope(struct Fleet* fleet, int begin, int end) {
+    envelopeKernel(fleet, begin, end, NULL);
+}
+
+// Performance-dependent kernels for one block of aircraft
+struct FleetKernels {
+    void (*aerodynamics)(struct Fleet* fleet, int begin, int end);
+    void (*envelope)(struct Fleet* fleet, int begin, int end);
+};
+
+// Specialised kernels per built-in type, used for blocks flown by that type
+// only. Build with -DAPM_NO_SPECIALIZE to always use the generic ones.
+#ifndef APM_NO_SPECIALIZE
+#define FLEET_SPECIALIZED
+#define X(id, ...) \
+    static void fleetAerodynamics_##id(struct Fleet* fleet, int begin, int end) { \
+        aerodynamicsKernel(fleet, begin, end, &builtin_aircraft[AIRCRAFT_##id].perf); \
+    } \
+    static void fleetEnvelope_##id(struct Fleet* fleet, int begin, int end) { \
+        envelopeKernel(fleet, begin, end, &builtin_aircraft[AIRCRAFT_##id].perf); \
+    }
+BUILTIN_AIRCRAFT(X)
+#undef X
+#define X(id, ...) {fleetAerodynamics_##id, fleetEnvelope_##id},
+static const struct FleetKernels specialized_kernels[NUM_AIRCRAFT_TYPES] = { BUILTIN_AIRCRAFT(X) };
+#undef X
+#endif
+static const struct FleetKernels generic_kernels = {fleetCalculateAerodynamics, fleetCheckFlightEnvelope};
+
+// Kernels for fleet aircraft [begin, end): specialised when they are all
+// one built-in type
+static const struct FleetKernels* fleetKernels(const struct Fleet* fleet, int begin, int end) {
+#ifdef FLEET_SPECIALIZED
+    int type = fleet->type[begin];
+    for (int i = begin + 1; i < end; i++) {
+        if (fleet->type[i] != type) return &generic_kernels;
+    }
+    if (type < NUM_AIRCRAFT_TYPES) return &specialized_kernels[type];
+#endif
+    (void)fleet; (void)begin; (void)end;
+    return &generic_kernels;
+}
+
+// Fleet version of updateInstruments()
+void fleetUpdateInstruments(struct Fleet* fleet, int begin, int end, float dt) {
+    for (int i = begin; i < end; i++) {
+        if (!fleet->active[i]) continue;
+        fleet->vertical_speed[i] = (fleet->altitude[i] - fleet->prev_altitude[i]) / dt * 60.0;
+        fleet->prev_altitude[i] = fleet->altitude[i];
+    }
+}
+
+// Fleet version of updateWeather(), each aircraft carries its own weather
+// and draws from its own random stream
+void fleetUpdateWeather(struct Fleet* fleet, int begin, int end, float dt, int substep) {
+    for (int i = begin; i < end; i++) {
+        if (!fleet->active[i]) continue;
+        if (!weather_grid) {
+            unsigned int step = (unsigned int)(fleet->flight_time[i] / fleet->tick) * fleet->substeps + substep;
+            fleet->wind_speed[i] += (int)(rngCounter(fleet->seed, fleet->rng_stream[i], step * 2) % 3 - 1) * 0.5 * sqrt(dt);
+            fleet->wind_direction[i] += (int)(rngCounter(fleet->seed, fleet->rng_stream[i], step * 2 + 1) % 3 - 1) * 5.0 * sqrt(dt);
+            fleet->air_temperature[i] = isaLookup(isa.temperature, fleet->altitude[i]) + fleet->temperature[i] - 15.0f;
+        }
+        fleet->air_pressure[i] = isaLookup(isa.pressure, 328.08f); // 100 m
+    }
+}
+
+// Advance aircraft [begin, end) by one tick of fleet->substeps physics
+// steps on a pool worker, returns how many are still flying
+int fleetStep(struct Fleet* fleet, int begin, int end, int worker) {
+    const float dt = (float)fleet->tick / fleet->substeps;
+    int flying = 0;
+    for (int b = begin; b < end; b += FLEET_BLOCK) {
+        int e = b + FLEET_BLOCK < end ? b + FLEET_BLOCK : end;
+        unsigned char ticking[FLEET_BLOCK];
+        for (int i = b; i < e; i++) ticking[i - b] = (unsigned char)fleet->active[i];
+        const struct FleetKernels* kernels = fleetKernels(fleet, b, e);
+        for (int s = 0; s < fleet->substeps; s++) {
+            fleetUpdateFlight(fleet, b, e, dt);
+            kernels->aerodynamics(fleet, b, e);
+            fleetCalculateWindEffect(fleet, b, e, s * dt, worker);
+            fleetUpdateNavigation(fleet, b, e, dt);
+            kernels->envelope(fleet, b, e);
+            fleetUpdateInstruments(fleet, b, e, dt);
+            fleetUpdateWeather(fleet, b, e, dt, s);
+            if (s + 1 == fleet->substeps) break;
+            for (int i = b; i < e; i++) { // landed or out of fuel mid-tick
+                if (fleet->fuel[i] <= 0 || (fleet->phase[i] == 5 && fleet->altitude[i] <= 0)) {
+                    fleet->active[i] = 0;
+                }
+            }
+        }
+        for (int i = b; i < e; i++) {
+            if (!ticking[i - b]) continue;
+            fleet->flight_time[i] += fleet->tick;
+            if (fleet->fuel[i] <= 0 || (fleet->phase[i] == 5 && fleet->altitude[i] <= 0) ||
+                fleet->flight_time[i] >= MAX_FLIGHT_TIME) {
+                fleet->active[i] = 0;
+            } else {
+                flying++;
+            }
+        }
+    }
+    return flying;
+}
+
+// Take a chunk from a queue: front for the owner, back when stealing.
+// Returns the chunk index or -1 when the queue is empty.
+int takeChunk(struct WorkQueue* queue, int steal) {
+    for (;;) {
+        int range = SDL_AtomicGet(&queue->range);
+        int next = range & 0xFFFF;
+        int end = range >> 16;
+        if (next >= end) return -1;
+        int updated = steal ? (end - 1) << 16 | next : end << 16 | (next + 1);
+        if (SDL_AtomicCAS(&queue->range, range, updated)) return steal ? end - 1 : next;
+    }
+}
+
+// Step chunks until every queue is empty
+void poolWork(struct ThreadPool* pool, int id) {
+    struct Fleet* fleet = pool->fleet;
+    int flying = 0;
+    for (;;) {
+        int chunk = takeChunk(&pool->queues[id], 0);
+        for (int v = 1; chunk < 0 && v < pool->workers; v++) {
+            chunk = takeChunk(&pool->queues[(id + v) % pool->workers], 1);
+        }
+        if (chunk < 0) break;
+
+        // Aircraft never interact, so a chunk runs all its ticks in one go
+        int begin = chunk * pool->chunk_size;
+        int end = begin + pool->chunk_size < fleet->count ? begin + pool->chunk_size : fleet->count;
+        int left = 0;
+        for (int t = 0; t < pool->max_ticks; t++) {
+            left = fleetStep(fleet, begin, end, id);
+            if (left == 0) break;
+        }
+        flying += left;
+    }
+    SDL_AtomicAdd(&pool->flying, flying);
+}
+
+// Worker thread main loop
+int poolWorkerThread(void* data) {
+    struct PoolWorker* worker = data;
+    for (;;) {
+        SDL_SemWait(worker->start);
+        if (worker->pool->quit) break;
+        poolWork(worker->pool, worker->id);
+        SDL_SemPost(worker->pool->done);
+    }
+    return 0;
+}
+
+// Create a pool with the given number of workers (0 = one per CPU)
+struct ThreadPool* threadPoolCreate(int workers) {
+    if (workers <= 0) workers = SDL_GetCPUCount();
+    if (workers > MAX_WORKERS) workers = MAX_WORKERS;
+    if (workers < 1) workers = 1;
+    struct ThreadPool* pool = calloc(1, sizeof(struct ThreadPool));
+    if (!pool) return NULL;
+    pool->workers = workers;
+    pool->done = SDL_CreateSemaphore(0);
+    for (int i = 1; i < workers; i++) {
+        struct PoolWorker* worker = &pool->worker[i];
+        worker->pool = pool;
+        worker->id = i;
+        if (weather_grid && !weatherCacheCreate(weather_grid, i)) {
+            pool->workers = i;
+            break;
+        }
+        worker->start = SDL_CreateSemaphore(0);
+        worker->thread = SDL_CreateThread(poolWorkerThread, "apm-worker", worker);
+        if (!worker->thread) {
+            printf("ERROR: Could not start worker thread: %s\n", SDL_GetError());
+            SDL_DestroySemaphore(worker->start);
+            pool->workers = i;
+            break;
+        }
+    }
+    return pool;
+}
+
+// Stop the workers and free the pool
+void threadPoolDestroy(struct ThreadPool* pool) {
+    if (!pool) return;
+    pool->quit = 1;
+    for (int i = 1; i < pool->workers; i++) {
+        SDL_SemPost(pool->worker[i].start);
+        SDL_WaitThread(pool->worker[i].thread, NULL);
+        SDL_DestroySemaphore(pool->worker[i].start);
+    }
+    SDL_DestroySemaphore(pool->done);
+    free(pool);
+}
+
+// Step the whole fleet for up to max_ticks ticks across the pool, returns
+// how many aircraft are still flying. Results do not depend on the number
+// of workers: chunks are fixed-size and each aircraft only touches its own
+// columns and random stream.
+int threadPoolStepFleet(struct ThreadPool* pool, struct Fleet* fleet, int max_ticks) {
+    int chunk_size = FLEET_CHUNK;
+    while ((fleet->count + chunk_size - 1) / chunk_size > 0x7FFF) chunk_size *= 2;
+    while (chunk_size > 16 && (fleet->count + chunk_size - 1) / chunk_size < pool->workers * 4) {
+        chunk_size /= 2; // small fleets: enough chunks to balance across workers
+    }
+    int chunks = (fleet->count + chunk_size - 1) / chunk_size;
+
+    pool->fleet = fleet;
+    pool->chunk_size = chunk_size;
+    pool->max_ticks = max_ticks;
+    SDL_AtomicSet(&pool->flying, 0);
+    for (int w = 0; w < pool->workers; w++) {
+        int begin = chunks * w / pool->workers;
+        int end = chunks * (w + 1) / pool->workers;
+        SDL_AtomicSet(&pool->queues[w].range, end << 16 | begin);
+    }
+    for (int w = 1; w < pool->workers; w++) SDL_SemPost(pool->worker[w].start);
+    poolWork(pool, 0);
+    for (int w = 1; w < pool->workers; w++) SDL_SemWait(pool->done);
+    return SDL_AtomicGet(&pool->flying);
+}
+
+// Hash of the fleet's state columns, for checking runs are bit-identical
+unsigned int fleetChecksum(const struct Fleet* fleet) {
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < fleet->count; i++) {
+        float values[] = { fleet->altitude[i], fleet->speed[i], fleet->fuel[i],
+                           fleet->lat[i], fleet->lon[i], fleet->distance_remaining[i] };
+        const unsigned char* bytes = (const unsigned char*)values;
+        for (size_t b = 0; b < sizeof(values); b++) hash = (hash ^ bytes[b]) * 16777619u;
+        hash = (hash ^ (unsigned int)fleet->flight_time[i]) * 16777619u;
+    }
+    return hash;
+}
+
+
+// Great-circle distances for n point pairs, batched version of calculateDistance()
+void batchDistance(const float* lat1, const float* lon1, const float* lat2, const float* lon2,
+                   float* out, int n) {
+    int i = 0;
+#ifdef SIMD_LANES
+    const vfloat half_deg = vset((float)(PI / 180.0 / 2));
+    const vfloat deg = vset((float)(PI / 180.0));
+    for (; i + SIMD_LANES <= n; i += SIMD_LANES) {
+        vfloat a_lat = vload(lat1 + i);
+        vfloat b_lat = vload(lat2 + i);
+        vfloat dlat_sin, dlat_cos, dlon_sin, dlon_cos, a_sin, a_cos, b_sin, b_cos;
+        vsincos(vmul(vsub(b_lat, a_lat), half_deg), &dlat_sin, &dlat_cos);
+        vsincos(vmul(vsub(vload(lon2 + i), vload(lon1 + i)), half_deg), &dlon_sin, &dlon_cos);
+        vsincos(vmul(a_lat, deg), &a_sin, &a_cos);
+        vsincos(vmul(b_lat, deg), &b_sin, &b_cos);
+        vfloat a = vadd(vmul(dlat_sin, dlat_sin), vmul(vmul(a_cos, b_cos), vmul(dlon_sin, dlon_sin)));
+        a = vmin(vmax(a, vset(0.0f)), vset(1.0f));
+        vfloat c = vmul(vset(2.0f), vatan2(vsqrt(a), vsqrt(vsub(vset(1.0f), a))));
+        vstore(out + i, vmul(vset(3440.0f), c));
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = calculateDistance(lat1[i], lon1[i], lat2[i], lon2[i]);
+    }
+}
+
+// Compare the batched fleet kernels against the scalar step functions.
+// Usage: apm --check-kernels
+int checkKernels(void) {
+    const int samples = 100000;
+    struct Fleet fleet;
+    if (!fleetAlloc(&fleet, samples)) {
+        printf("ERROR: Could not allocate kernel check fleet!\n");
+        return 1;
+    }
+    float* lat2 = malloc(samples * sizeof(float));
+    float* lon2 = malloc(samples * sizeof(float));
+    float* batched = malloc(samples * sizeof(float));
+    if (!lat2 || !lon2 || !batched) {
+        printf("ERROR: Out of memory!\n");
+        free(lat2); free(lon2); free(batched); fleetFree(&fleet);
+        return 1;
+    }
+
+    buildFlightPlan(&flight_plan, dep_idx, NULL, 0, dest_idx); // every sample tracks the same plan
+    srand(12345);
+    for (int i = 0; i < samples; i++) {
+        struct FlightData aircraft = {0};
+        struct Weather weather = initial_weather;
+        aircraft.speed = rand() % 5000 / 10.0;
+        aircraft.heading = rand() % 7200 / 10.0 - 360;
+        aircraft.lat = rand() % 16000 / 100.0 - 80;
+        aircraft.lon = rand() % 36000 / 100.0 - 180;
+        weather.wind_speed = rand() % 1500 / 10.0;
+        weather.wind_direction = rand() % 14400 / 10.0 - 720;
+        weather.pressure = 800 + rand() % 2500 / 10.0;
+        aircraft.altitude = rand() % 45000;
+        aircraft.phase = 3;
+        fleetAddAircraft(&fleet, &aircraft, &weather, &flight_plan);
+        lat2[i] = rand() % 16000 / 100.0 - 80;
+        lon2[i] = rand() % 36000 / 100.0 - 180;
+    }
+    fleetCalculateWindEffect(&fleet, 0, fleet.count, 0, 0);
+    fleetCalculateAerodynamics(&fleet, 0, fleet.count);
+    fleetUpdateNavigation(&fleet, 0, fleet.count, 1.0f);
+    batchDistance(fleet.lat, fleet.lon, lat2, lon2, batched, fleet.count);
+
+    double gs_err = 0, ias_err = 0, mach_err = 0, g_err = 0, pos_err = 0, dist_err = 0;
+    double track_err = 0, heading_err = 0, isa_err = 0;
+    srand(12345);
+    for (int i = 0; i < samples; i++) {
+        plane = (struct FlightData){0};
+        current_weather = initial_weather;
+        plane.speed = rand() % 5000 / 10.0;
+        plane.heading = rand() % 7200 / 10.0 - 360;
+        plane.lat = rand() % 16000 / 100.0 - 80;
+        plane.lon = rand() % 36000 / 100.0 - 180;
+        current_weather.wind_speed = rand() % 1500 / 10.0;
+        current_weather.wind_direction = rand() % 14400 / 10.0 - 720;
+        current_weather.pressure = 800 + rand() % 2500 / 10.0;
+        plane.altitude = rand() % 45000;
+        plane.phase = 3;
+        rand(); rand();
+        calculateWindEffect(0);
+        calculateAerodynamics();
+        updateNavigation(1.0f);
+        gs_err = fmax(gs_err, fabs(plane.ground_speed - fleet.ground_speed[i]));
+        ias_err = fmax(ias_err, fabs(plane.indicated_airspeed - fleet.indicated_airspeed[i]));
+        mach_err = fmax(mach_err, fabs(plane.mach_number - fleet.mach_number[i]));
+        g_err = fmax(g_err, fabs(plane.g_force - fleet.g_force[i]) / fmax(plane.g_force, 1e-3));
+        pos_err = fmax(pos_err, fabs(plane.lat - fleet.lat[i]) * 60);
+        pos_err = fmax(pos_err, fabs(plane.lon - fleet.lon[i]) * 60 * cos(plane.lat * PI / 180.0));
+        track_err = fmax(track_err, fabs(plane.distance_remaining - fleet.distance_remaining[i]));
+        track_err = fmax(track_err, fabs(plane.cross_track - fleet.cross_track[i]));
+        float turn = fabsf(fmodf(plane.heading - fleet.heading[i] + 540.0f, 360.0f) - 180);
+        heading_err = fmax(heading_err, turn);
+        float distance = calculateDistance(fleet.lat[i], fleet.lon[i], lat2[i], lon2[i]);
+        dist_err = fmax(dist_err, fabs(distance - batched[i]) / fmax(distance, 100.0));
+    }
+
+    // Standard atmosphere tables against the exact model, every foot
+    for (float h = -2000; h <= 65000; h += 1) {
+        double theta, delta;
+        isaExact(h, &theta, &delta);
+        isa_err = fmax(isa_err, fabs(isaLookup(isa.density_ratio, h) / (delta / theta) - 1));
+        isa_err = fmax(isa_err, fabs(isaLookup(isa.density_sqrt, h) / sqrt(delta / theta) - 1));
+        isa_err = fmax(isa_err, fabs(isaLookup(isa.pressure, h) / (1013.25 * delta) - 1));
+        isa_err = fmax(isa_err, fabs((isaLookup(isa.temperature, h) + 273.15) / (288.15 * theta) - 1));
+        isa_err = fmax(isa_err, fabs(isaLookup(isa.sound_speed, h) / (661.47 * sqrt(theta)) - 1));
+    }
+
+    // Tolerances: well inside the %.0f resolution of the log and cockpit.
+    // Distance is relative (floored at 100 nm) since near-antipodal pairs are
+    // ill-conditioned in single precision for the scalar version too.
+    int failed = 0;
+    printf("Kernel check (%s), %d samples\n", SIMD_NAME, samples);
+    printf("  Ground speed:   max error %.6f kt   %s\n", gs_err, gs_err < 0.01 ? "PASS" : (failed = 1, "FAIL"));
+    printf("  IAS:            max error %.6f kt   %s\n", ias_err, ias_err < 0.01 ? "PASS" : (failed = 1, "FAIL"));
+    printf("  Mach:           max error %.2e     %s\n", mach_err, mach_err < 1e-5 ? "PASS" : (failed = 1, "FAIL"));
+    printf("  G load:         max error %.2e rel  %s\n", g_err, g_err < 1e-5 ? "PASS" : (failed = 1, "FAIL"));
+    printf("  Atmosphere:     max error %.2e rel  %s\n", isa_err, isa_err < 2e-5 ? "PASS" : (failed = 1, "FAIL"));
+    printf("  Position:       max error %.6f nm   %s\n", pos_err, pos_err < 0.01 ? "PASS" : (failed = 1, "FAIL"));
+    printf("  Distance:       max error %.2e rel  %s\n", dist_err, dist_err < 1e-5 ? "PASS" : (failed = 1, "FAIL"));
+    printf("  Leg tracking:   max error %.6f nm   %s\n", track_err, track_err < 0.01 ? "PASS" : (failed = 1, "FAIL"));
+    printf("  Steering:       max error %.6f deg  %s\n", heading_err, heading_err < 0.01 ? "PASS" : (failed = 1, "FAIL"));
+
+    free(lat2); free(lon2); free(batched);
+    fleetFree(&fleet);
+    return failed;
+}
+
+// Headless batch mode: fly whole sectors back to back with no SDL or
+// wall-clock pacing. Usage:
+//   apm --headless [--runs N] [--fleet N] [--from CMB] [--to DEL]
+//                  [--via FIX,FIX,...] [--type CODE] [--seed N] [--threads N] [--log file]
+//                  [--binary|--binary-log] [--async-log block|drop|grow]
+//                  [--tick S] [--substeps N] [--checkpoint S|tod FILE]
+//                  [--telemetry ADDRESS] [--subscribers N]
+// With --fleet every run flies N aircraft together on the fleet engine,
+// spread over --threads workers (default: one per CPU). Each tick covers
+// --tick seconds (one log line) in --substeps physics steps. --checkpoint
+// saves a snapshot of the first run after S seconds or at top of descent.
+// --telemetry streams every tick from the log writer thread, after waiting
+// for --subscribers subscribers if given. --async-log drop never slows the
+// simulation but keeps only what the writer thread has time for: on a
+// single CPU that is about one tick in ten.
+int runHeadless(int argc, char *argv[]) {
+    int runs = 1;
+    int fleet_size = 0;
+    int threads = 0;
+    int type = AIRCRAFT_BOEING737;
+    unsigned int seed = (unsigned int)time(NULL);
+    const char* log_path = NULL;
+    int binary_log = 0;
+    int async = 0;
+    LogBackpressure policy = LOG_BLOCK;
+    FILE* log = NULL;
+    struct LogRecorder* recorder = NULL;
+    struct AsyncLog* async_log = NULL;
+    const char* checkpoint_path = NULL;
+    int checkpoint_at = 0; // s, or -1 for top of descent
+    const char* telemetry_address = NULL;
+    int subscribers = 0;
+    struct Telemetry* telemetry = NULL;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+            runs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--checkpoint") == 0 && i + 2 < argc) {
+            i++;
+            checkpoint_at = strcmp(argv[i], "tod") == 0 ? -1 : atoi(argv[i]);
+            checkpoint_path = argv[++i];
+        } else if (strcmp(argv[i], "--fleet") == 0 && i + 1 < argc) {
+            fleet_size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--from") == 0 && i + 1 < argc) {
+            dep_idx = findAirport(argv[++i]);
+        } else if (strcmp(argv[i], "--to") == 0 && i + 1 < argc) {
+            dest_idx = findAirport(argv[++i]);
+        } else if (strcmp(argv[i], "--via") == 0 && i + 1 < argc) {
+            if (!parseVia(argv[++i])) {
+                printf("ERROR: --via takes up to %d comma separated codes!\n", MAX_WAYPOINTS);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--type") == 0 && i + 1 < argc) {
+            type = parseAircraftType(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = (unsigned int)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--log") == 0 && i + 1 < argc) {
+            log_path = argv[++i];
+        } else if (strcmp(argv[i], "--binary") == 0 || strcmp(argv[i], "--binary-log") == 0) {
+            binary_log = 1;
+        } else if (strcmp(argv[i], "--tick") == 0 && i + 1 < argc) {
+            sim_tick = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--substeps") == 0 && i + 1 < argc) {
+            sim_substeps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--async-log") == 0 && i + 1 < argc) {
+            const char* mode = argv[++i];
+            async = 1;
+            if (strcmp(mode, "drop") == 0) policy = LOG_DROP_NEWEST;
+            else if (strcmp(mode, "grow") == 0) policy = LOG_GROW;
+            else if (strcmp(mode, "block") != 0) async = -1;
+        } else if (strcmp(argv[i], "--telemetry") == 0 && i + 1 < argc) {
+            telemetry_address = argv[++i];
+        } else if (strcmp(argv[i], "--subscribers") == 0 && i + 1 < argc) {
+            subscribers = atoi(argv[++i]);
+        } else {
+            printf("ERROR: Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (dep_idx < 0 || dest_idx < 0 || dep_idx == dest_idx) {
+        printf("ERROR: Invalid route!\n");
+        return 1;
+    }
+    if (!buildFlightPlan(&flight_plan, dep_idx, route_via, route_via_count, dest_idx)) {
+        printf("ERROR: Flight plan needs more than %d legs!\n", MAX_PLAN_LEGS);
+        return 1;
+    }
+    if (type < 0 || runs < 1 || fleet_size < 0) {
+        printf("ERROR: Invalid aircraft type or run count!\n");
+        return 1;
+    }
+    if (async < 0) {
+        printf("ERROR: --async-log takes block, drop or grow!\n");
+        return 1;
+    }
+    if (sim_tick < 1 || sim_tick > MAX_TICK || sim_substeps < 1 || sim_substeps > MAX_SUBSTEPS) {
+        printf("ERROR: --tick takes 1-3600 seconds and --substeps 1-1000!\n");
+        return 1;
+    }
+    if ((log_path || checkpoint_path || telemetry_address) && fleet_size > 0) {
+        printf("ERROR: --log, --checkpoint and --telemetry are not supported with --fleet!\n");
+        return 1;
+    }
+    if (subscribers < 0 || subscribers > TELEMETRY_MAX_SUBSCRIBERS || (subscribers > 0 && !telemetry_address)) {
+        printf("ERROR: --subscribers takes 0-%d and needs --telemetry!\n", TELEMETRY_MAX_SUBSCRIBERS);
+        return 1;
+    }
+    struct Fleet fleet = {0};
+    struct ThreadPool* pool = NULL;
+    if (fleet_size > 0) {
+        if (!fleetAlloc(&fleet, fleet_size)) {
+            printf("ERROR: Could not allocate fleet of %d aircraft!\n", fleet_size);
+            return 1;
+        }
+        pool = threadPoolCreate(threads);
+        if (!pool) {
+            printf("ERROR: Could not create thread pool!\n");
+            fleetFree(&fleet);
+            return 1;
+        }
+        fleet.seed = seed;
+        fleet.tick = sim_tick;
+        fleet.substeps = sim_substeps;
+    }
+    if (log_path && binary_log) {
+        recorder = recorderOpen(log_path, (AircraftType)type, dep_idx, dest_idx);
+        if (!recorder) {
+            printf("ERROR: Could not open %s!\n", log_path);
+            return 1;
+        }
+    } else if (log_path) {
+        log = fopen(log_path, "w");
+        if (!log) {
+            printf("ERROR: Could not open %s!\n", log_path);
+            return 1;
+        }
+    }
+    if (telemetry_address) {
+        telemetry = telemetryOpen(telemetry_address);
+        if (!telemetry || (subscribers > 0 && !telemetryWait(telemetry, subscribers, telemetry_address))) {
+            telemetryClose(telemetry);
+            if (log) fclose(log);
+            recorderClose(recorder);
+            return 1;
+        }
+    }
+    if ((async && log_path) || telemetry) {
+        async_log = asyncLogOpen(log, recorder, telemetry, policy, airports[dep_idx].name, airports[dest_idx].name);
+        if (!async_log) {
+            telemetryClose(telemetry);
+            if (log) fclose(log);
+            recorderClose(recorder);
+            return 1;
+        }
+    }
+
+    quiet = 1;
+    sim_seed = seed;
+    long long total_ticks = 0;
+    unsigned int checksum = 0;
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    for (int run = 0; run < runs; run++) {
+        current_weather = initial_weather;
+        plane = (struct FlightData){0};
+        flight_time = 0;
+        warning_count = 0;
+        initFlight();
+        plane.type = (AircraftType)type;
+        initAircraftPerformance(plane.type);
+        plane.phase = 1; // Cleared for takeoff
+
+        if (fleet_size > 0) {
+            fleet.count = 0;
+            for (int a = 0; a < fleet_size; a++) {
+                fleetAddAircraft(&fleet, &plane, &current_weather, &flight_plan);
+            }
+            threadPoolStepFleet(pool, &fleet, MAX_FLIGHT_TIME);
+            for (int a = 0; a < fleet.count; a++) total_ticks += fleet.flight_time[a] / sim_tick;
+            checksum = checksum * 31 + fleetChecksum(&fleet);
+            fleetLoad(&fleet, fleet.count - 1, &plane);
+            flight_time = fleet.flight_time[fleet.count - 1];
+            warning_count = fleet.warnings[fleet.count - 1];
+            continue;
+        }
+
+        while (!flightComplete() && flight_time < MAX_FLIGHT_TIME) {
+            stepSimulation();
+            if (async_log) PROFILE_SAMPLED(STAGE_LOGGING, asyncLogPush(async_log, flight_time, 0, &plane));
+            else if (recorder) PROFILE_SAMPLED(STAGE_LOGGING, recorderAppend(recorder, flight_time, &plane));
+            else if (log) PROFILE_SAMPLED(STAGE_LOGGING, logData(log));
+            flight_time += sim_tick;
+            if (checkpoint_path && run == 0 && (checkpoint_at < 0 ? plane.phase >= 4 : flight_time >= checkpoint_at)) {
+                struct Snapshot snapshot;
+                snapshotTake(&snapshot);
+                if (!snapshotSave(&snapshot, checkpoint_path)) return 1;
+                printf("Checkpoint at %d s (%s) saved to %s\n", flight_time, getPhaseName(plane.phase), checkpoint_path);
+                checkpoint_path = NULL;
+            }
+        }
+        if (async_log) asyncLogPush(async_log, flight_time, 1, &plane);
+        else if (recorder) recorderEndFlight(recorder);
+        else if (log) {
+            fprintf(log, "[END] Alt: %.0f ft, Speed: %.0f kt, Fuel: %.1f gal, Dist Remain: %.0f nm\n",
+                    plane.altitude, plane.speed, plane.fuel, plane.distance_remaining);
+        }
+        total_ticks += flight_time / sim_tick;
+    }
+
+    double elapsed = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    if (elapsed <= 0) elapsed = 1e-9;
+    int sectors = fleet_size > 0 ? runs * fleet_size : runs;
+    printf("Headless: %d sector(s) %s -> %s (%s), seed %u, %d s tick, dt %.3g s\n",
+           sectors, airports[dep_idx].code, airports[dest_idx].code,
+           getAircraftName((AircraftType)type), seed, sim_tick, (double)sim_tick / sim_substeps);
+    printf("Simulated %lld aircraft-ticks in %.3f s (%.0f sectors/s, %.1f ns/tick)\n",
+           total_ticks, elapsed, sectors / elapsed, elapsed * 1e9 / total_ticks);
+    printf("Last sector: %s after %d s, Fuel: %.1f gal, Dist Remain: %.0f nm, Warnings: %d\n",
+           plane.phase == 5 && plane.altitude <= 0 ? "Landed" :
+           plane.fuel <= 0 ? "Fuel Out" : "Timed Out",
+           flight_time, plane.fuel, plane.distance_remaining, warning_count);
+    if (pool) printf("Fleet: %d worker(s), state checksum %08x\n", pool->workers, checksum);
+    if (weather_grid) {
+        long long loads = 0;
+        for (int w = 0; w < MAX_WORKERS; w++) loads += weather_grid->cache[w] ? weather_grid->cache[w]->loads : 0;
+        printf("Weather: %lld tile(s) read from the grid\n", loads);
+    }
+
+    asyncLogClose(async_log);
+    telemetryClose(telemetry);
+    if (log) fclose(log);
+    recorderClose(recorder);
+    threadPoolDestroy(pool);
+    fleetFree(&fleet);
+    return 0;
+}
+
+// qsort comparison for floats, ascending
+int compareFloats(const void* a, const void* b) {
+    float x = *(const float*)a, y = *(const float*)b;
+    return (x > y) - (x < y);
+}
+
+// qsort comparison for doubles, ascending
+int compareDoubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Print min, percentiles, max and mean of a sample; sorts it in place
+void printDistribution(const char* name, float* values, int n) {
+    double sum = 0;
+    for (int i = 0; i < n; i++) sum += values[i];
+    qsort(values, n, sizeof(float), compareFloats);
+    const float levels[] = {0.05f, 0.25f, 0.50f, 0.75f, 0.95f};
+    printf("  %-18s %9.1f", name, values[0]);
+    for (int l = 0; l < 5; l++) {
+        int rank = (int)ceilf(levels[l] * n) - 1; // nearest-rank percentile
+        printf(" %9.1f", values[rank < 0 ? 0 : rank]);
+    }
+    printf(" %9.1f %9.1f\n", values[n - 1], sum / n);
+}
+
+// Monte Carlo dispersion: fly many perturbed copies of one sector on the
+// fleet engine and report the spread of the outcomes. Usage:
+//   apm --monte-carlo [--runs N] [--from CMB] [--to DEL] [--via FIX,...] [--type CODE|mix]
+//                     [--seed N] [--threads N] [--wind-sd KT] [--temp-sd C]
+//                     [--throttle-sd X] [--tick S] [--substeps N]
+// Every run draws its perturbations and weather from its own counter-based
+// random stream, so results are bit-identical for any thread count.
+int runMonteCarlo(int argc, char *argv[]) {
+    int runs = 10000;
+    int threads = 0;
+    int type = AIRCRAFT_BOEING737;
+    int mixed_types = 0;
+    unsigned int seed = (unsigned int)time(NULL);
+    float wind_sd = 10;       // kt
+    float direction_sd = 30;  // degrees, scaled with wind_sd
+    float temp_sd = 5;        // C
+    float throttle_sd = 0.05;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+            runs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--from") == 0 && i + 1 < argc) {
+            dep_idx = findAirport(argv[++i]);
+        } else if (strcmp(argv[i], "--to") == 0 && i + 1 < argc) {
+            dest_idx = findAirport(argv[++i]);
+        } else if (strcmp(argv[i], "--via") == 0 && i + 1 < argc) {
+            if (!parseVia(argv[++i])) {
+                printf("ERROR: --via takes up to %d comma separated codes!\n", MAX_WAYPOINTS);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--type") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "mix") == 0) mixed_types = 1;
+            else type = parseAircraftType(argv[i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = (unsigned int)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--wind-sd") == 0 && i + 1 < argc) {
+            wind_sd = atof(argv[++i]);
+            direction_sd = wind_sd * 3;
+        } else if (strcmp(argv[i], "--temp-sd") == 0 && i + 1 < argc) {
+            temp_sd = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--throttle-sd") == 0 && i + 1 < argc) {
+            throttle_sd = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--tick") == 0 && i + 1 < argc) {
+            sim_tick = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--substeps") == 0 && i + 1 < argc) {
+            sim_substeps = atoi(argv[++i]);
+        } else {
+            printf("ERROR: Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (dep_idx < 0 || dest_idx < 0 || dep_idx == dest_idx) {
+        printf("ERROR: Invalid route!\n");
+        return 1;
+    }
+    if (!buildFlightPlan(&flight_plan, dep_idx, route_via, route_via_count, dest_idx)) {
+        printf("ERROR: Flight plan needs more than %d legs!\n", MAX_PLAN_LEGS);
+        return 1;
+    }
+    if (type < AIRCRAFT_CESSNA || type > AIRCRAFT_AIRBUS320 || runs < 1) {
+        printf("ERROR: Invalid aircraft type or run count!\n");
+        return 1;
+    }
+    if (sim_tick < 1 || sim_tick > MAX_TICK || sim_substeps < 1 || sim_substeps > MAX_SUBSTEPS) {
+        printf("ERROR: --tick takes 1-3600 seconds and --substeps 1-1000!\n");
+        return 1;
+    }
+
+    struct Fleet fleet;
+    if (!fleetAlloc(&fleet, runs)) {
+        printf("ERROR: Could not allocate %d runs!\n", runs);
+        return 1;
+    }
+    struct ThreadPool* pool = threadPoolCreate(threads);
+    float* fuel = malloc(runs * sizeof(float));
+    float* minutes = malloc(runs * sizeof(float));
+    float* warnings = malloc(runs * sizeof(float));
+    if (!pool || !fuel || !minutes || !warnings) {
+        printf("ERROR: Out of memory!\n");
+        threadPoolDestroy(pool);
+        free(fuel); free(minutes); free(warnings);
+        fleetFree(&fleet);
+        return 1;
+    }
+    fleet.seed = seed;
+    fleet.tick = sim_tick;
+    fleet.substeps = sim_substeps;
+
+    // Perturbations use counters far above the weather's 2 * step range
+    const unsigned int draw = 0xFFFFFF00u;
+    for (int r = 0; r < runs; r++) {
+        struct Weather weather = initial_weather;
+        current_weather = initial_weather;
+        plane = (struct FlightData){0};
+        initFlight();
+        plane.type = mixed_types ? (AircraftType)(rngCounter(seed, r, draw) % aircraft_type_count)
+                                 : (AircraftType)type;
+        plane.phase = 1; // Cleared for takeoff
+        plane.throttle = fminf(fmaxf(plane.throttle + throttle_sd * rngNormal(seed, r, draw + 2), 0.5f), 1.0f);
+        weather.wind_speed = fmaxf(weather.wind_speed + wind_sd * rngNormal(seed, r, draw + 4), 0);
+        weather.wind_direction += direction_sd * rngNormal(seed, r, draw + 6);
+        weather.temperature += temp_sd * rngNormal(seed, r, draw + 8);
+        plane.temperature = weather.temperature;
+        fleetAddAircraft(&fleet, &plane, &weather, &flight_plan);
+    }
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    threadPoolStepFleet(pool, &fleet, MAX_FLIGHT_TIME / sim_tick);
+    double elapsed = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+
+    int landed = 0, fuel_out = 0;
+    for (int r = 0; r < runs; r++) {
+        if (fleet.fuel[r] <= 0) fuel_out++;
+        else if (fleet.phase[r] == 5 && fleet.altitude[r] <= 0) landed++;
+        fuel[r] = fleet.fuel[r];
+        minutes[r] = fleet.flight_time[r] / 60.0f;
+        warnings[r] = fleet.warnings[r];
+    }
+
+    printf("Monte Carlo: %d runs %s -> %s (%s), seed %u, %d worker(s), %.3f s\n",
+           runs, airports[dep_idx].code, airports[dest_idx].code,
+           mixed_types ? "mixed types" : getAircraftName((AircraftType)type), seed, pool->workers, elapsed);
+    printf("  Dispersion: wind %.1f kt / %.0f deg, temperature %.1f C, throttle %.3f (1 sd)\n",
+           wind_sd, direction_sd, temp_sd, throttle_sd);
+    printf("  %-18s %9s %9s %9s %9s %9s %9s %9s %9s\n", "", "min", "p5", "p25", "p50", "p75", "p95", "max", "mean");
+    printDistribution("Fuel left (gal)", fuel, runs);
+    printDistribution("Flight time (min)", minutes, runs);
+    printDistribution("Warnings", warnings, runs);
+    printf("  Landed %d, fuel out %d, timed out %d, state checksum %08x\n",
+           landed, fuel_out, runs - landed - fuel_out, fleetChecksum(&fleet));
+
+    threadPoolDestroy(pool);
+    free(fuel); free(minutes); free(warnings);
+    fleetFree(&fleet);
+    return 0;
+}
+
+// Route matrix: fly every directed airport pair with every aircraft type
+// in one fleet and print block time, fuel burn and warnings. Usage:
+//   apm --route-matrix [--seed N] [--threads N] [--tick S] [--substeps N] [--csv file]
+int runRouteMatrix(int argc, char *argv[]) {
+    int threads = 0;
+    unsigned int seed = (unsigned int)time(NULL);
+    const char* csv_path = NULL;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = (unsigned int)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--tick") == 0 && i + 1 < argc) {
+            sim_tick = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--substeps") == 0 && i + 1 < argc) {
+            sim_substeps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+            csv_path = argv[++i];
+        } else {
+            printf("ERROR: Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (sim_tick < 1 || sim_tick > MAX_TICK || sim_substeps < 1 || sim_substeps > MAX_SUBSTEPS) {
+        printf("ERROR: --tick takes 1-3600 seconds and --substeps 1-1000!\n");
+        return 1;
+    }
+
+    const int sectors = MAX_AIRPORTS * (MAX_AIRPORTS - 1) * NUM_AIRCRAFT_TYPES;
+    struct Fleet fleet;
+    float start_fuel[MAX_AIRPORTS * (MAX_AIRPORTS - 1) * NUM_AIRCRAFT_TYPES];
+    if (!fleetAlloc(&fleet, sectors)) {
+        printf("ERROR: Out of memory!\n");
+        return 1;
+    }
+    struct ThreadPool* pool = threadPoolCreate(threads);
+    if (!pool) {
+        printf("ERROR: Could not create thread pool!\n");
+        fleetFree(&fleet);
+        return 1;
+    }
+    fleet.seed = seed;
+    fleet.tick = sim_tick;
+    fleet.substeps = sim_substeps;
+
+    // Sector index: (dep * (MAX_AIRPORTS - 1) + dest slot) * NUM_AIRCRAFT_TYPES + type
+    buildRouteMatrix();
+    for (int dep = 0; dep < MAX_AIRPORTS; dep++) {
+        for (int dest = 0; dest < MAX_AIRPORTS; dest++) {
+            if (dest == dep) continue;
+            for (int t = 0; t < NUM_AIRCRAFT_TYPES; t++) {
+                current_weather = initial_weather;
+                plane = (struct FlightData){0};
+                dep_idx = dep;
+                dest_idx = dest;
+                initFlight();
+                plane.type = (AircraftType)t;
+                plane.phase = 1; // Cleared for takeoff
+                start_fuel[fleet.count] = plane.fuel;
+                fleetAddAircraft(&fleet, &plane, &current_weather, &flight_plan);
+            }
+        }
+    }
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    threadPoolStepFleet(pool, &fleet, MAX_FLIGHT_TIME / sim_tick);
+    double elapsed = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+
+    FILE* csv = csv_path ? fopen(csv_path, "w") : NULL;
+    if (csv_path && !csv) printf("ERROR: Could not open %s!\n", csv_path);
+    if (csv) fprintf(csv, "from,to,distance_nm,type,outcome,block_time_min,fuel_burn_gal,warnings\n");
+
+    printf("Route matrix: %d sectors, seed %u, %d worker(s), %.3f s\n", sectors, seed, pool->workers, elapsed);
+    printf("%-9s %6s", "Route", "nm");
+    for (int t = 0; t < NUM_AIRCRAFT_TYPES; t++) printf(" | %-22s", getAircraftName((AircraftType)t));
+    printf("\n%-9s %6s", "", "");
+    for (int t = 0; t < NUM_AIRCRAFT_TYPES; t++) printf(" | %5s %8s %6s ", "min", "fuel", "warn");
+    printf("\n");
+    int completed = 0;
+    for (int i = 0; i < sectors; i += NUM_AIRCRAFT_TYPES) {
+        int dep = i / NUM_AIRCRAFT_TYPES / (MAX_AIRPORTS - 1);
+        int dest = i / NUM_AIRCRAFT_TYPES % (MAX_AIRPORTS - 1);
+        if (dest >= dep) dest++;
+        printf("%s-%-5s %6.0f", airports[dep].code, airports[dest].code, route_distance[dep][dest]);
+        for (int t = 0; t < NUM_AIRCRAFT_TYPES; t++) {
+            int a = i + t;
+            int landed = fleet.phase[a] == 5 && fleet.altitude[a] <= 0 && fleet.fuel[a] > 0;
+            completed += landed;
+            printf(" | %5d %8.1f %6d%c", fleet.flight_time[a] / 60, start_fuel[a] - fleet.fuel[a],
+                   fleet.warnings[a], landed ? ' ' : '*');
+            if (csv) {
+                fprintf(csv, "%s,%s,%.0f,%s,%s,%.1f,%.1f,%d\n", airports[dep].code, airports[dest].code,
+                        route_distance[dep][dest], getAircraftName((AircraftType)t),
+                        landed ? "Landed" : fleet.fuel[a] <= 0 ? "Fuel Out" : "Timed Out",
+                        fleet.flight_time[a] / 60.0, start_fuel[a] - fleet.fuel[a], fleet.warnings[a]);
+            }
+        }
+        printf("\n");
+    }
+    printf("%d of %d sectors landed (* = fuel out or timed out)\n", completed, sectors);
+
+    if (csv) fclose(csv);
+    threadPoolDestroy(pool);
+    fleetFree(&fleet);
+    return 0;
+}
+
+// Diversion query from a position, or a timing run over random positions.
+// Usage: apm [--airports file] --divert LAT LON [--type CODE] [--k N]
+//                              [--speed KT] [--wind KT DEG] [--visibility NM] [--queries N]
+// --wind gives the wind speed and the direction it blows toward.
+int runDiversionQuery(int argc, char *argv[]) {
+    int type = AIRCRAFT_BOEING737;
+    int k = 5;
+    int queries = 0;
+    struct Weather weather = initial_weather;
+    struct DiversionQuery query = {0};
+    query.lat = atof(argv[2]);
+    query.lon = atof(argv[3]);
+    query.speed = 0;
+
+    for (int i = 4; i < argc; i++) {
+        if (strcmp(argv[i], "--type") == 0 && i + 1 < argc) {
+            type = parseAircraftType(argv[++i]);
+        } else if (strcmp(argv[i], "--k") == 0 && i + 1 < argc) {
+            k = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            query.speed = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--wind") == 0 && i + 2 < argc) {
+            weather.wind_speed = atof(argv[++i]);
+            weather.wind_direction = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--visibility") == 0 && i + 1 < argc) {
+            weather.visibility = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--queries") == 0 && i + 1 < argc) {
+            queries = atoi(argv[++i]);
+        } else {
+            printf("ERROR: Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (type < 0 || k < 1 || k > MAX_DIVERSIONS || weather.wind_speed < 0) {
+        printf("ERROR: Invalid aircraft type, --k (1-%d) or --wind!\n", MAX_DIVERSIONS);
+        return 1;
+    }
+    struct AircraftPerformance p = getAircraftPerformance((AircraftType)type);
+    if (query.speed <= 0) query.speed = p.vno;
+    query.wind_speed = weather.wind_speed;
+    query.wind_direction = weather.wind_direction;
+    query.visibility = weather.visibility;
+    query.perf = &p;
+
+    if (queries > 0) {
+        // One tick's worth of queries: a fleet of random aircraft of all types
+        struct Fleet fleet;
+        struct Diversion* all = malloc(sizeof(struct Diversion) * k * queries);
+        int* found_count = malloc(sizeof(int) * queries);
+        if (!all || !found_count || !fleetAlloc(&fleet, queries)) {
+            printf("ERROR: Out of memory for %d diversion queries!\n", queries);
+            free(all);
+            free(found_count);
+            return 1;
+        }
+        for (int q = 0; q < queries; q++) {
+            struct FlightData aircraft = {0};
+            aircraft.type = (AircraftType)(q % NUM_AIRCRAFT_TYPES);
+            aircraft.lat = rngUniform(1, q, 0) * 140 - 70;
+            aircraft.lon = rngUniform(1, q, 1) * 360 - 180;
+            aircraft.true_airspeed = fleet.perf[aircraft.type].vno;
+            fleetAddAircraft(&fleet, &aircraft, &weather, NULL);
+        }
+        long long total = 0;
+        Uint64 start = SDL_GetPerformanceCounter();
+        fleetFindDiversions(&fleet, 0, fleet.count, weather.visibility, k, all, found_count);
+        double elapsed = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+        for (int q = 0; q < queries; q++) total += found_count[q];
+        printf("%d diversion queries (k = %d, %d airports) in %.3f s: %.1f us/query, %.1f results/query\n",
+               queries, k, airport_count, elapsed, elapsed * 1e6 / queries, (double)total / queries);
+        fleetFree(&fleet);
+        free(all);
+        free(found_count);
+        return 0;
+    }
+
+    struct Diversion found[MAX_DIVERSIONS];
+
+    int n = findDiversions(&query, k, found);
+    printf("Diversions for %s at (%.4f, %.4f), %.0f kt, wind %.0f kt toward %.0f, visibility %.1f nm%s\n",
+           getAircraftName((AircraftType)type), query.lat, query.lon, query.speed, query.wind_speed,
+           query.wind_direction, query.visibility, query.visibility < ILS_VISIBILITY ? " (ILS required)" : "");
+    for (int i = 0; i < n; i++) {
+        const struct Airport* a = &airports[found[i].airport];
+        printf("  %d. %-6s %-24s %6.0f nm %8.1f gal  rwy %5.0f ft%s\n", i + 1, a->code, a->name,
+               found[i].distance, found[i].fuel, a->runway_length, a->has_ils ? "  ILS" : "");
+    }
+    if (n == 0) printf("  No suitable airport.\n");
+    return 0;
+}
+
+// Write a snapshot blob as hex after a journal line prefix
+static void journalSnapshot(FILE* journal, const char* prefix, const struct Snapshot* snapshot) {
+    unsigned char blob[SNAPSHOT_MAX_SIZE];
+    size_t size = snapshotEncode(snapshot, blob, sizeof(blob));
+    fputs(prefix, journal);
+    for (size_t i = 0; i < size; i++) fprintf(journal, "%02x", blob[i]);
+    fputc('\n', journal);
+}
+
+// Read a hex snapshot blob from a journal line, returns 0 if invalid
+static int journalReadSnapshot(const char* hex, struct Snapshot* snapshot) {
+    unsigned char blob[SNAPSHOT_MAX_SIZE];
+    size_t size = 0;
+    unsigned int byte;
+    while (size < sizeof(blob) && sscanf(hex, "%2x", &byte) == 1) {
+        blob[size++] = (unsigned char)byte;
+        hex += 2;
+    }
+    return snapshotDecode(snapshot, blob, size);
+}
+
+// Start an input journal with the current simulation state, which
+// includes the weather seed. Returns NULL if the file cannot be opened.
+FILE* journalOpen(const char* path) {
+    FILE* journal = fopen(path, "w");
+    if (!journal) return NULL;
+    struct Snapshot snapshot;
+    snapshotTake(&snapshot);
+    fprintf(journal, "APMJ %d\n", JOURNAL_VERSION);
+    journalSnapshot(journal, "start ", &snapshot);
+    fflush(journal);
+    return journal;
+}
+
+// Record every control that differs from journaled as changed before the
+// tick at time, then bring journaled up to date
+void journalControls(FILE* journal, int time, struct FlightData* journaled) {
+    int changed = 0;
+#define X(name) \
+    if (plane.name != journaled->name) { \
+        fprintf(journal, "%d " #name " %.9g\n", time, (double)plane.name); \
+        journaled->name = plane.name; \
+        changed = 1; \
+    }
+    JOURNAL_CONTROLS(X)
+#undef X
+    if (changed) fflush(journal);
+}
+
+// Record that the simulation was restored from a snapshot before the tick
+// at time
+void journalRestore(FILE* journal, int time, const struct Snapshot* snapshot) {
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "%d restore ", time);
+    journalSnapshot(journal, prefix, snapshot);
+    fflush(journal);
+}
+
+// Record where the session ended and close the journal
+void journalClose(FILE* journal, int time) {
+    if (!journal) return;
+    fprintf(journal, "%d end\n", time);
+    fclose(journal);
+}
+
+// Queue a control command for the next tick, returns 0 when the queue is full
+int commandPush(struct CommandQueue* queue, int control, float value) {
+    unsigned int head = (unsigned int)SDL_AtomicGet(&queue->head);
+    if (head - (unsigned int)SDL_AtomicGet(&queue->tail) >= COMMAND_QUEUE_SIZE) {
+        printf("ERROR: Control queue full, input dropped!\n");
+        return 0;
+    }
+    queue->items[head & (COMMAND_QUEUE_SIZE - 1)] = (struct ControlCommand){control, value};
+    SDL_AtomicSet(&queue->head, (int)(head + 1));
+    return 1;
+}
+
+// Apply the queued commands in order. Out-of-range values fall back to
+// the same defaults as the console prompts did.
+void commandApply(struct CommandQueue* queue, struct FlightData* aircraft) {
+    unsigned int tail = (unsigned int)SDL_AtomicGet(&queue->tail);
+    unsigned int head = (unsigned int)SDL_AtomicGet(&queue->head);
+    for (; tail != head; tail++) {
+        const struct ControlCommand* command = &queue->items[tail & (COMMAND_QUEUE_SIZE - 1)];
+        switch (command->control) {
+            case CONTROL_THROTTLE:
+                aircraft->throttle = command->value >= 0 && command->value <= 1 ? command->value : 0.8;
+                break;
+            case CONTROL_BANK_ANGLE:
+                aircraft->bank_angle = command->value >= MIN_BANK_ANGLE && command->value <= MAX_BANK_ANGLE ?
+                                       command->value : 15;
+                break;
+            case CONTROL_FLAPS: {
+                int flaps = (int)command->value;
+                aircraft->flaps = flaps >= 0 && flaps <= 40 ? flaps : 0;
+                break;
+            }
+            case CONTROL_GEAR: aircraft->gear = !aircraft->gear; break;
+            case CONTROL_AUTOPILOT: aircraft->autopilot = !aircraft->autopilot; break;
+            case CONTROL_TRANSPONDER: aircraft->transponder = !aircraft->transponder; break;
+        }
+    }
+    SDL_AtomicSet(&queue->tail, (int)tail);
+}
+
+// Open the cockpit's entry line for a typed control value
+void entryBegin(int control) {
+    control_entry.control = control;
+    control_entry.text[0] = '\0';
+    control_entry.length = 0;
+    SDL_StartTextInput();
+}
+
+// Add typed characters to the entry, keeping those that can be part of a number
+void entryText(const char* text) {
+    for (; *text; text++) {
+        if (!strchr("0123456789.-", *text) || control_entry.length >= ENTRY_LENGTH - 1) continue;
+        control_entry.text[control_entry.length++] = *text;
+        control_entry.text[control_entry.length] = '\0';
+    }
+}
+
+// Edit keys while an entry is open: Backspace deletes, Enter queues the
+// value for the next tick and Escape drops it. Other keys are ignored.
+void entryKey(SDL_Keycode key, struct CommandQueue* queue) {
+    if (key == SDLK_BACKSPACE) {
+        if (control_entry.length > 0) control_entry.text[--control_entry.length] = '\0';
+        return;
+    }
+    if (key != SDLK_RETURN && key != SDLK_KP_ENTER && key != SDLK_ESCAPE) return;
+    char* end;
+    float value = strtof(control_entry.text, &end);
+    if (key != SDLK_ESCAPE && end != control_entry.text) commandPush(queue, control_entry.control, value);
+    control_entry.control = -1;
+    SDL_StopTextInput();
+}
+
+// Re-fly a journaled session headlessly: restore its start state, apply
+// each recorded input before the tick it was made in and stop where the
+// session stopped. Usage:
+//   apm [--airports file] [--aircraft file] --replay FILE [--until S]
+//       [--skip N] [--warnings] [--log file]
+// --skip N leaves out the Nth input and --until S stops early, for
+// bisecting which input led to an envelope warning; --warnings prints
+// every tick that raised one. --log writes the flight log the session wrote.
+int runReplay(int argc, char *argv[]) {
+    int until = -1;
+    int skip = 0;
+    int trace = 0;
+    const char* log_path = NULL;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--until") == 0 && i + 1 < argc) {
+            until = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--skip") == 0 && i + 1 < argc) {
+            skip = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--warnings") == 0) {
+            trace = 1;
+        } else if (strcmp(argv[i], "--log") == 0 && i + 1 < argc) {
+            log_path = argv[++i];
+        } else {
+            printf("ERROR: Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    FILE* journal = fopen(argv[2], "r");
+    if (!journal) {
+        printf("ERROR: Could not open %s!\n", argv[2]);
         return 1;
     }
+    char line[2 * SNAPSHOT_MAX_SIZE + 64];
+    int version = 0;
+    struct Snapshot snapshot;
+    if (!fgets(line, sizeof(line), journal) || sscanf(line, "APMJ %d", &version) != 1 ||
+        version != JOURNAL_VERSION || !fgets(line, sizeof(line), journal) ||
+        strncmp(line, "start ", 6) != 0 || !journalReadSnapshot(line + 6, &snapshot)) {
+        printf("ERROR: %s is not an input journal for the loaded airports and aircraft!\n", argv[2]);
+        fclose(journal);
+        return 1;
+    }
+    FILE* log = NULL;
+    if (log_path && !(log = fopen(log_path, "w"))) {
+        printf("ERROR: Could not open %s!\n", log_path);
+        fclose(journal);
+        return 1;
+    }
+    snapshotRestore(&snapshot);
+    quiet = 1;
+    printf("Replay: %s -> %s (%s), seed %u\n", airports[dep_idx].code, airports[dest_idx].code,
+           getAircraftName(plane.type), sim_seed);
 
-    if (!initSDL()) {
+    int inputs = 0, applied = 0, end = -1, first_warning = -1;
+    int event_time = 0, offset = 0;
+    char name[32];
+    int pending = 0; // a parsed event is waiting for its tick
+    int exhausted = 0;
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (;;) {
+        for (;;) {
+            if (!pending) {
+                if (!fgets(line, sizeof(line), journal)) {
+                    exhausted = 1;
+                    break;
+                }
+                if (sscanf(line, "%d %31s %n", &event_time, name, &offset) < 2) continue;
+                pending = 1;
+            }
+            if (event_time > flight_time) break;
+            pending = 0;
+            if (strcmp(name, "end") == 0) {
+                end = event_time;
+                continue;
+            }
+            if (++inputs == skip) continue;
+            applied++;
+            if (strcmp(name, "restore") == 0) {
+                if (!journalReadSnapshot(line + offset, &snapshot)) {
+                    printf("ERROR: Bad snapshot at %d s in %s!\n", event_time, argv[2]);
+                    fclose(journal);
+                    if (log) fclose(log);
+                    return 1;
+                }
+                snapshotRestore(&snapshot);
+                continue;
+            }
+            double value = atof(line + offset);
+#define X(field) if (strcmp(name, #field) == 0) plane.field = value;
+            JOURNAL_CONTROLS(X)
+#undef X
+        }
+        if (flightComplete() || (end >= 0 && flight_time >= end) || (until >= 0 && flight_time >= until)) break;
+        if (exhausted && end < 0 && until < 0 && flight_time >= MAX_FLIGHT_TIME) break; // journal cut short
+        int warnings = warning_count;
+        stepSimulation();
+        if (warning_count > warnings) {
+            if (first_warning < 0) first_warning = flight_time;
+            if (trace) {
+                printf("  %6d s  +%d warning(s)  %-8s alt %6.0f ft  speed %4.0f kt  G %.2f\n", flight_time,
+                       warning_count - warnings, getPhaseName(plane.phase), plane.altitude, plane.speed,
+                       plane.g_force);
+            }
+        }
+        if (log) logData(log);
+        flight_time += sim_tick;
+    }
+    fclose(journal);
+    if (log) {
+        fprintf(log, "[END] Alt: %.0f ft, Speed: %.0f kt, Fuel: %.1f gal, Dist Remain: %.0f nm\n",
+                plane.altitude, plane.speed, plane.fuel, plane.distance_remaining);
         fclose(log);
+    }
+    double elapsed = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    if (elapsed <= 0) elapsed = 1e-9;
+
+    printf("Replayed %d of %d input(s) over %d s in %.3f ms (%.0fx real time)\n",
+           applied, inputs, flight_time, elapsed * 1e3, flight_time / elapsed);
+    printf("End: %s after %d s, Fuel: %.1f gal, Dist Remain: %.0f nm, Warnings: %d",
+           plane.phase == 5 && plane.altitude <= 0 ? "Landed" :
+           plane.fuel <= 0 ? "Fuel Out" : flight_time == end ? "Session ended" : "Stopped",
+           flight_time, plane.fuel, plane.distance_remaining, warning_count);
+    if (first_warning >= 0) printf(", first at %d s", first_warning);
+    printf("\n");
+    return 0;
+}
+
+// Continue a saved flight to the end on the single-aircraft path.
+// Usage: apm [--airports file] [--aircraft file] --restore FILE
+int runRestore(const char* path) {
+    struct Snapshot snapshot;
+    if (!snapshotLoad(&snapshot, path)) return 1;
+    snapshotRestore(&snapshot);
+    quiet = 1;
+    printf("Restored %s -> %s (%s) at %d s, seed %u\n", airports[dep_idx].code, airports[dest_idx].code,
+           getAircraftName(plane.type), flight_time, sim_seed);
+    while (!flightComplete() && flight_time < MAX_FLIGHT_TIME) {
+        stepSimulation();
+        flight_time += sim_tick;
+    }
+    printf("Last sector: %s after %d s, Fuel: %.1f gal, Dist Remain: %.0f nm, Warnings: %d\n",
+           plane.phase == 5 && plane.altitude <= 0 ? "Landed" :
+           plane.fuel <= 0 ? "Fuel Out" : "Timed Out",
+           flight_time, plane.fuel, plane.distance_remaining, warning_count);
+    return 0;
+}
+
+// What-if branches from a saved flight, flown on the fleet engine. Each
+// branch gets its own weather stream; --wind-sd perturbs its wind and
+// --divert sends the branches, in equal groups, to the ranked diversion
+// airports from the snapshot position instead of the destination. Usage:
+//   apm [--airports file] [--aircraft file] --fork FILE [--branches N]
+//       [--divert] [--k N] [--wind-sd KT] [--threads N]
+int runFork(int argc, char *argv[]) {
+    int branches = 1000;
+    int divert = 0;
+    int k = 5;
+    int threads = 0;
+    float wind_sd = 0;
+    struct Snapshot base;
+    if (!snapshotLoad(&base, argv[2])) return 1;
+
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--branches") == 0 && i + 1 < argc) {
+            branches = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--divert") == 0) {
+            divert = 1;
+        } else if (strcmp(argv[i], "--k") == 0 && i + 1 < argc) {
+            k = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--wind-sd") == 0 && i + 1 < argc) {
+            wind_sd = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else {
+            printf("ERROR: Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (branches < 1 || k < 1 || k > MAX_DIVERSIONS) {
+        printf("ERROR: Invalid --branches or --k (1-%d)!\n", MAX_DIVERSIONS);
+        return 1;
+    }
+
+    // Destinations: the planned one, or the ranked diversions
+    int targets[MAX_DIVERSIONS];
+    struct FlightPlan* plans = malloc(sizeof(struct FlightPlan) * MAX_DIVERSIONS);
+    int target_count = 0;
+    if (!plans) {
+        printf("ERROR: Out of memory!\n");
+        return 1;
+    }
+    if (divert) {
+        struct AircraftPerformance p = getAircraftPerformance(base.plane.type);
+        struct DiversionQuery query = {base.plane.lat, base.plane.lon, base.plane.true_airspeed,
+                                       base.weather.wind_speed, base.weather.wind_direction,
+                                       base.weather.visibility, &p};
+        if (query.speed <= 0) query.speed = p.vno;
+        struct Diversion found[MAX_DIVERSIONS];
+        int n = findDiversions(&query, k, found);
+        for (int i = 0; i < n; i++) {
+            if (buildDirectPlan(&plans[target_count], base.plane.lat, base.plane.lon, found[i].airport)) {
+                targets[target_count++] = found[i].airport;
+            }
+        }
+        if (target_count == 0) {
+            printf("ERROR: No suitable diversion airport!\n");
+            free(plans);
+            return 1;
+        }
+    } else {
+        plans[0] = base.plan;
+        targets[target_count++] = base.dest;
+    }
+
+    struct Fleet fleet;
+    if (!fleetAlloc(&fleet, branches)) {
+        printf("ERROR: Could not allocate %d branches!\n", branches);
+        free(plans);
+        return 1;
+    }
+    struct ThreadPool* pool = threadPoolCreate(threads);
+    if (!pool) {
+        printf("ERROR: Could not create thread pool!\n");
+        fleetFree(&fleet);
+        free(plans);
         return 1;
     }
+    fleet.seed = base.seed;
+    fleet.tick = base.tick;
+    fleet.substeps = base.substeps;
+
+    // Perturbations use counters far above the weather's 2 * step range
+    const unsigned int draw = 0xFFFFFF00u;
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int b = 0; b < branches; b++) {
+        struct Snapshot branch = base;
+        int t = (int)((long long)b * target_count / branches);
+        if (divert) {
+            branch.plan = plans[t];
+            branch.dest = targets[t];
+            divertAircraft(&branch.plane, &branch.plan);
+        }
+        if (wind_sd > 0) {
+            branch.weather.wind_speed = fmaxf(branch.weather.wind_speed + wind_sd * rngNormal(base.seed, b, draw + 4), 0);
+            branch.weather.wind_direction += wind_sd * 3 * rngNormal(base.seed, b, draw + 6);
+        }
+        fleetAddSnapshot(&fleet, &branch);
+    }
+    double fork_time = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    start = SDL_GetPerformanceCounter();
+    threadPoolStepFleet(pool, &fleet, MAX_FLIGHT_TIME / base.tick);
+    double elapsed = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    if (fork_time <= 0) fork_time = 1e-9;
+
+    printf("Fork: %d branch(es) of %s -> %s (%s) at %d s, phase %s, %.0f nm to go\n",
+           branches, airports[base.dep].code, airports[base.dest].code, getAircraftName(base.plane.type),
+           base.flight_time, getPhaseName(base.plane.phase), base.plane.distance_remaining);
+    printf("  Forked in %.3f ms (%.0f branches/s), flown in %.3f s on %d worker(s)\n",
+           fork_time * 1e3, branches / fork_time, elapsed, pool->workers);
+    printf("  %-6s %8s %7s %9s %10s %9s %10s\n", "To", "Branches", "Landed", "Fuel out", "Fuel left", "Min to go", "Miss (nm)");
+    for (int t = 0; t < target_count; t++) {
+        int first = (int)(((long long)t * branches + target_count - 1) / target_count);
+        int last = (int)(((long long)(t + 1) * branches + target_count - 1) / target_count);
+        int landed = 0, fuel_out = 0;
+        double fuel = 0, minutes = 0, miss = 0;
+        for (int b = first; b < last; b++) {
+            if (fleet.fuel[b] <= 0) fuel_out++;
+            else if (fleet.phase[b] == 5 && fleet.altitude[b] <= 0) landed++;
+            fuel += fleet.fuel[b];
+            minutes += (fleet.flight_time[b] - base.flight_time) / 60.0;
+            miss += fleet.distance_remaining[b];
+        }
+        int n = last - first;
+        if (n == 0) continue;
+        printf("  %-6s %8d %7d %9d %10.1f %9.1f %10.0f\n", airports[targets[t]].code, n, landed, fuel_out,
+               fuel / n, minutes / n, miss / n);
+    }
+    printf("  State checksum %08x\n", fleetChecksum(&fleet));
+
+    threadPoolDestroy(pool);
+    fleetFree(&fleet);
+    free(plans);
+    return 0;
+}
+
+// Benchmark state: flight states sampled along one reference flight,
+// dealt out to the benchmark fleet, and the scalar starting state
+static struct Snapshot bench_states[BENCH_STATES];
+static struct Snapshot bench_start;
+static struct Fleet bench_fleet;
+static FILE* bench_sink;
 
+// Fly the reference flight and sample BENCH_STATES states along it
+static void benchInit(void) {
+    dep_idx = 0;
+    dest_idx = 1;
+    route_via_count = 0;
+    sim_seed = BENCH_SEED;
+    sim_tick = 1;
+    sim_substeps = 1;
+    current_weather = initial_weather;
+    plane = (struct FlightData){0};
+    flight_time = 0;
+    warning_count = 0;
+    initFlight();
     initAircraftPerformance(plane.type);
+    plane.phase = 1; // Cleared for takeoff
+    struct Snapshot takeoff;
+    snapshotTake(&takeoff);
+    while (!flightComplete() && flight_time < MAX_FLIGHT_TIME) {
+        stepSimulation();
+        flight_time += sim_tick;
+    }
+    int duration = flight_time;
+    snapshotRestore(&takeoff);
+    for (int s = 0; s < BENCH_STATES; s++) {
+        while (flight_time < (long long)duration * s / BENCH_STATES) {
+            stepSimulation();
+            flight_time += sim_tick;
+        }
+        snapshotTake(&bench_states[s]);
+        if (plane.phase == 3 && bench_start.flight_time == 0) bench_start = bench_states[s];
+    }
+    if (bench_start.flight_time == 0) bench_start = bench_states[BENCH_STATES / 2];
+}
+
+// Put n aircraft back into their starting states
+static void benchReset(int n) {
+    if (n == 1) {
+        snapshotRestore(&bench_start);
+        return;
+    }
+    bench_fleet.count = 0;
+    bench_fleet.plan_count = 0;
+    for (int i = 0; i < n; i++) fleetAddSnapshot(&bench_fleet, &bench_states[i % BENCH_STATES]);
+}
+
+// Benchmarked functions: the scalar path for one aircraft, the fleet
+// kernels (single-threaded) for more
+static void benchUpdateFlight(int n) {
+    if (n == 1) updateFlight(1.0f);
+    else fleetUpdateFlight(&bench_fleet, 0, n, 1.0f);
+}
+static void benchAerodynamics(int n) {
+    if (n == 1) calculateAerodynamics();
+    else fleetCalculateAerodynamics(&bench_fleet, 0, n);
+}
+static void benchWindEffect(int n) {
+    if (n == 1) calculateWindEffect(flight_time);
+    else fleetCalculateWindEffect(&bench_fleet, 0, n, 0, 0);
+}
+static void benchNavigation(int n) {
+    if (n == 1) updateNavigation(1.0f);
+    else fleetUpdateNavigation(&bench_fleet, 0, n, 1.0f);
+}
+static void benchEnvelope(int n) {
+    if (n == 1) checkFlightEnvelope();
+    else fleetCheckFlightEnvelope(&bench_fleet, 0, n);
+}
+static void benchLogData(int n) {
+    if (n == 1) {
+        logData(bench_sink);
+        return;
+    }
+    char line[512];
+    struct FlightData aircraft;
+    for (int i = 0; i < n; i++) {
+        fleetLoad(&bench_fleet, i, &aircraft);
+        formatLogLine(line, sizeof(line), bench_fleet.flight_time[i], &aircraft,
+                      airports[dep_idx].name, airports[dest_idx].name);
+        fputs(line, bench_sink);
+    }
+}
+static void benchStep(int n) {
+    if (n == 1) stepSimulation();
+    else fleetStep(&bench_fleet, 0, n, 0);
+}
+
+// Median and minimum over repeats samples of ns per aircraft-tick. Each
+// sample runs about work aircraft-ticks, in batches of up to BENCH_TICKS
+// ticks from the starting states so every sample does the same work.
+static void benchMeasure(struct BenchResult* result, void (*run)(int), int n, long long work, int repeats) {
+    int ticks = (int)(work / n);
+    if (ticks > BENCH_TICKS) ticks = BENCH_TICKS;
+    if (ticks < 1) ticks = 1;
+    long long batches = work / ((long long)ticks * n);
+    if (batches < 1) batches = 1;
+    double samples[BENCH_MAX_REPEATS];
+    for (int r = -1; r < repeats; r++) { // r = -1 warms up
+        Uint64 total = 0;
+        for (long long b = 0; b < batches; b++) {
+            benchReset(n);
+            Uint64 start = SDL_GetPerformanceCounter();
+            for (int t = 0; t < ticks; t++) run(n);
+            total += SDL_GetPerformanceCounter() - start;
+        }
+        if (r >= 0) {
+            samples[r] = (double)total * 1e9 / SDL_GetPerformanceFrequency() / ((double)batches * ticks * n);
+        }
+    }
+    qsort(samples, repeats, sizeof(double), compareDoubles);
+    result->aircraft = n;
+    result->unit = "ns/tick";
+    result->median_ns = samples[repeats / 2];
+    result->min_ns = samples[0];
+}
+
+// Median and minimum ns per renderCockpit() frame over repeats samples of
+// frames frames. full repaints every panel each frame; otherwise the
+// display moves between two ticks like the live cockpit does.
+static void benchRender(struct BenchResult* result, int full, int frames, int repeats) {
+    double samples[BENCH_MAX_REPEATS];
+    snapshotRestore(&bench_start);
+    struct FlightData from = plane;
+    stepSimulation();
+    struct FlightData to = plane;
+    for (int r = -1; r < repeats; r++) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        for (int f = 0; f < frames; f++) {
+            if (full) invalidateCockpit(1);
+            interpolateFlight(&display, &from, &to, (float)f / frames);
+            renderCockpit();
+        }
+        if (r >= 0) {
+            samples[r] = (double)(SDL_GetPerformanceCounter() - start) * 1e9 / SDL_GetPerformanceFrequency() / frames;
+        }
+    }
+    qsort(samples, repeats, sizeof(double), compareDoubles);
+    result->aircraft = 1;
+    result->unit = "ns/frame";
+    result->median_ns = samples[repeats / 2];
+    result->min_ns = samples[0];
+}
+
+// Compare results with a --json file from an earlier run, returns the
+// number of benchmarks more than tolerance (fraction) slower
+static int benchCompare(const struct BenchResult* results, int count, const char* path, double tolerance) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        printf("ERROR: Could not open %s!\n", path);
+        return -1;
+    }
+    char line[256], name[64];
+    int aircraft, regressions = 0;
+    double median;
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, " \"simd\": \"%63[^\"]\"", name) == 1 && strcmp(name, SIMD_NAME) != 0) {
+            printf("NOTE: %s was measured with %s kernels, this build uses %s\n", path, name, SIMD_NAME);
+        }
+        const char* entry = strstr(line, "{\"benchmark\"");
+        if (!entry || sscanf(entry, "{\"benchmark\": \"%63[^\"]\", \"aircraft\": %d, \"unit\": \"%*[^\"]\", "
+                             "\"median_ns\": %lf", name, &aircraft, &median) != 3) continue;
+        for (int i = 0; i < count; i++) {
+            if (strcmp(results[i].name, name) != 0 || results[i].aircraft != aircraft) continue;
+            double change = results[i].median_ns / median - 1;
+            if (change > tolerance) {
+                printf("REGRESSION: %s x%d %.1f -> %.1f %s (%+.0f%%)\n", name, aircraft, median,
+                       results[i].median_ns, results[i].unit, change * 100);
+                regressions++;
+            }
+        }
+    }
+    fclose(file);
+    return regressions;
+}
+
+// Benchmark the simulation step functions and the cockpit renderer.
+// Usage: apm --bench [--sizes 1,1000,100000] [--repeats N] [--json FILE]
+//                    [--baseline FILE] [--tolerance PCT] [--no-render]
+// Step functions run from fixed states sampled along one seeded flight, so
+// every run measures the same work. The renderer draws offscreen with
+// SDL's software renderer. --json writes one result per line; --baseline
+// compares against such a file and fails if anything got slower than
+// --tolerance percent (default 10).
+int runBenchmarks(int argc, char *argv[]) {
+    int sizes[8] = {1, 1000, 100000};
+    int size_count = 3;
+    int repeats = 5;
+    int render = 1;
+    const char* json_path = NULL;
+    const char* baseline_path = NULL;
+    double tolerance = 0.10;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) {
+            const char* list = argv[++i];
+            for (size_count = 0; size_count < 8 && *list; size_count++) {
+                sizes[size_count] = atoi(list);
+                list += strcspn(list, ",");
+                if (*list == ',') list++;
+            }
+        } else if (strcmp(argv[i], "--repeats") == 0 && i + 1 < argc) {
+            repeats = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baseline_path = argv[++i];
+        } else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+            tolerance = atof(argv[++i]) / 100;
+        } else if (strcmp(argv[i], "--no-render") == 0) {
+            render = 0;
+        } else {
+            printf("ERROR: Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    int largest = 1;
+    for (int s = 0; s < size_count; s++) {
+        if (sizes[s] < 1) size_count = 0;
+        else if (sizes[s] > largest) largest = sizes[s];
+    }
+    if (size_count == 0 || repeats < 1 || repeats > BENCH_MAX_REPEATS) {
+        printf("ERROR: --sizes takes counts of at least 1 and --repeats 1-%d!\n", BENCH_MAX_REPEATS);
+        return 1;
+    }
+#ifdef _WIN32
+    bench_sink = fopen("NUL", "w");
+#else
+    bench_sink = fopen("/dev/null", "w");
+#endif
+    if (!bench_sink || !fleetAlloc(&bench_fleet, largest)) {
+        printf("ERROR: Could not set up the benchmark!\n");
+        if (bench_sink) fclose(bench_sink);
+        return 1;
+    }
+    quiet = 1;
+    benchInit();
+
+    static const struct {
+        const char* name;
+        void (*run)(int);
+        long long work; // aircraft-ticks per sample
+    } benchmarks[] = {
+        {"updateFlight", benchUpdateFlight, 1000000},
+        {"calculateAerodynamics", benchAerodynamics, 1000000},
+        {"calculateWindEffect", benchWindEffect, 1000000},
+        {"updateNavigation", benchNavigation, 1000000},
+        {"checkFlightEnvelope", benchEnvelope, 1000000},
+        {"logData", benchLogData, 100000},
+        {"step", benchStep, 1000000},
+    };
+    const int benchmark_count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+    struct BenchResult results[8 * 7 + 2];
+    int count = 0;
+    printf("Benchmarks (%s), median of %d, seed %u\n", SIMD_NAME, repeats, BENCH_SEED);
+    printf("  %-24s %9s %12s %12s\n", "", "aircraft", "median", "min");
+    for (int s = 0; s < size_count; s++) {
+        for (int b = 0; b < benchmark_count; b++) {
+            struct BenchResult* result = &results[count++];
+            result->name = benchmarks[b].name;
+            benchMeasure(result, benchmarks[b].run, sizes[s], benchmarks[b].work, repeats);
+            printf("  %-24s %9d %9.2f %s %9.2f\n", result->name, result->aircraft, result->median_ns,
+                   result->unit, result->min_ns);
+        }
+    }
+    if (render && initSDL(1)) {
+        for (int full = 0; full < 2; full++) {
+            struct BenchResult* result = &results[count++];
+            result->name = full ? "renderCockpit_full" : "renderCockpit";
+            benchRender(result, full, 200, repeats);
+            printf("  %-24s %9d %9.0f %s %9.0f\n", result->name, result->aircraft, result->median_ns,
+                   result->unit, result->min_ns);
+        }
+    } else if (render) {
+        printf("  Renderer benchmarks skipped\n");
+    }
+    if (render) cleanupSDL();
+    fclose(bench_sink);
+    fleetFree(&bench_fleet);
+
+    if (json_path) {
+        FILE* json = fopen(json_path, "w");
+        if (!json) {
+            printf("ERROR: Could not open %s!\n", json_path);
+            return 1;
+        }
+        fprintf(json, "{\n  \"schema\": %d,\n  \"simd\": \"%s\",\n  \"seed\": %u,\n  \"repeats\": %d,\n  \"results\": [\n",
+                BENCH_SCHEMA_VERSION, SIMD_NAME, BENCH_SEED, repeats);
+        for (int i = 0; i < count; i++) {
+            fprintf(json, "    {\"benchmark\": \"%s\", \"aircraft\": %d, \"unit\": \"%s\", \"median_ns\": %.2f, \"min_ns\": %.2f}%s\n",
+                    results[i].name, results[i].aircraft, results[i].unit, results[i].median_ns, results[i].min_ns,
+                    i + 1 < count ? "," : "");
+        }
+        fprintf(json, "  ]\n}\n");
+        fclose(json);
+    }
+    if (baseline_path) {
+        int regressions = benchCompare(results, count, baseline_path, tolerance);
+        if (regressions < 0) return 1;
+        printf("%d regression(s) over %.0f%% against %s\n", regressions, tolerance * 100, baseline_path);
+        if (regressions > 0) return 1;
+    }
+    return 0;
+}
+
+#ifdef APM_PROFILE
+// Start the profiler clock and measure the cost of one timed scope. With
+// trace_path set every scope is also kept for profileWriteTrace().
+int profileInit(const char* trace_path) {
+    for (int i = 0; i < 100000; i++) {
+        PROFILE(STAGE_EVENTS, (void)0);
+    }
+    profile_overhead = (double)profile_stages[STAGE_EVENTS].total / profile_stages[STAGE_EVENTS].count;
+    memset(profile_stages, 0, sizeof(profile_stages));
+    if (trace_path) {
+        profile_trace = malloc(sizeof(struct ProfileEvent) * PROFILE_TRACE_EVENTS);
+        if (!profile_trace) {
+            printf("ERROR: Out of memory for the profile trace!\n");
+            return 0;
+        }
+    }
+    profile_trace_path = trace_path;
+    profile_clock_start = profileNow();
+    profile_counter_start = SDL_GetPerformanceCounter();
+    return 1;
+}
+
+// Profiler clock ticks per ns, measured against SDL's performance counter
+// since profileInit()
+static double profileTicksPerNs(void) {
+    uint64_t ticks = profileNow() - profile_clock_start;
+    double ns = (double)(SDL_GetPerformanceCounter() - profile_counter_start) * 1e9 / SDL_GetPerformanceFrequency();
+    return ns > 0 ? ticks / ns : 1;
+}
+
+// Duration in ticks below which a fraction of a stage's scopes fell, to
+// the middle of its histogram bucket
+static double profilePercentile(const struct ProfileStage* stage, double fraction) {
+    uint64_t rank = (uint64_t)(fraction * (stage->count - 1)), seen = 0;
+    for (int b = 0; b < PROFILE_BUCKETS; b++) {
+        seen += stage->buckets[b];
+        if (seen <= rank) continue;
+        if (b < 4) return b;
+        int msb = b / 4;
+        double width = (double)(1ull << (msb - 2));
+        return (4 + b % 4) * width + width / 2;
+    }
+    return (double)stage->max;
+}
+
+// Print call counts and time per stage
+void profileReport(void) {
+    static const char* names[NUM_STAGES] = {
+#define X(id, name) name,
+        PROFILE_STAGES(X)
+#undef X
+    };
+    double per_ns = profileTicksPerNs();
+    double run_ms = (double)(SDL_GetPerformanceCounter() - profile_counter_start) * 1e3 / SDL_GetPerformanceFrequency();
+    uint64_t scopes = 0;
+    printf("Profile (%s, %.2f ticks/ns), physics stages timed every %d tick(s)\n", PROFILE_CLOCK, per_ns, profile_stride);
+    printf("  %-22s %10s %10s %10s %10s %10s %10s\n", "stage", "calls", "mean ns", "p50 ns", "p99 ns", "max ns", "total ms");
+    for (int i = 0; i < NUM_STAGES; i++) {
+        const struct ProfileStage* stage = &profile_stages[i];
+        if (stage->count == 0) continue;
+        scopes += stage->count;
+        printf("  %-22s %10llu %10.0f %10.0f %10.0f %10.0f %10.3f\n", names[i], (unsigned long long)stage->count,
+               stage->total / per_ns / stage->count, profilePercentile(stage, 0.5) / per_ns,
+               profilePercentile(stage, 0.99) / per_ns, stage->max / per_ns, stage->total / per_ns / 1e6);
+    }
+    double overhead_ms = scopes * profile_overhead / per_ns / 1e6;
+    printf("  Overhead: %.0f ns per scope, %.3f ms (%.2f%% of %.0f ms)\n", profile_overhead / per_ns, overhead_ms,
+           run_ms > 0 ? overhead_ms / run_ms * 100 : 0, run_ms);
+}
+
+// Write the recorded scopes as Chrome trace-event JSON, for
+// chrome://tracing or Perfetto
+int profileWriteTrace(const char* path) {
+    static const char* names[NUM_STAGES] = {
+#define X(id, name) name,
+        PROFILE_STAGES(X)
+#undef X
+    };
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        printf("ERROR: Could not open %s!\n", path);
+        return 0;
+    }
+    double per_us = profileTicksPerNs() * 1e3;
+    fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    for (int i = 0; i < profile_trace_count; i++) {
+        const struct ProfileEvent* event = &profile_trace[i];
+        fprintf(file, "{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, \"ts\": %.3f, \"dur\": %.3f}%s\n",
+                names[event->stage], (event->start - profile_clock_start) / per_us, event->ticks / per_us,
+                i + 1 < profile_trace_count ? "," : "");
+    }
+    fprintf(file, "]}\n");
+    fclose(file);
+    printf("Wrote %d trace events to %s%s\n", profile_trace_count, path,
+           profile_trace_count == PROFILE_TRACE_EVENTS ? " (buffer full, later scopes dropped)" : "");
+    return 1;
+}
+
+// Report and write the trace at exit
+void profileShutdown(void) {
+    profileReport();
+    if (profile_trace_path) profileWriteTrace(profile_trace_path);
+    free(profile_trace);
+    profile_trace = NULL;
+}
+#endif
+
+// Main function
+int main(int argc, char *argv[]) {
+    initAtmosphere();
+    if (!initAirports() || !initAircraftProfiles()) return 1;
+    // --airports FILE and --aircraft FILE before any mode add airports and
+    // waypoints, or aircraft types, from a file. --weather FILE flies every
+    // aircraft through a weather grid. --profile-trace FILE writes every
+    // profiled scope as a Chrome trace on exit.
+    const char* trace_path = NULL;
+    while (argc > 2 && (strcmp(argv[1], "--airports") == 0 || strcmp(argv[1], "--aircraft") == 0 ||
+                        strcmp(argv[1], "--weather") == 0 || strcmp(argv[1], "--profile-trace") == 0)) {
+        if (strcmp(argv[1], "--profile-trace") == 0) trace_path = argv[2];
+        else if (strcmp(argv[1], "--weather") == 0 ? !weatherOpen(argv[2])
+                 : strcmp(argv[1], "--airports") == 0 ? !loadAirports(argv[2]) : !loadAircraftProfiles(argv[2])) return 1;
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+#ifdef APM_PROFILE
+    if (!profileInit(trace_path)) return 1;
+    atexit(profileShutdown);
+#else
+    if (trace_path) {
+        printf("ERROR: --profile-trace needs a build with -DAPM_PROFILE!\n");
+        return 1;
+    }
+#endif
+    if (argc > 1 && strcmp(argv[1], "--headless") == 0) {
+        return runHeadless(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "--monte-carlo") == 0) {
+        return runMonteCarlo(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "--route-matrix") == 0) {
+        return runRouteMatrix(argc, argv);
+    }
+    if (argc > 3 && strcmp(argv[1], "--nearest") == 0) {
+        int i = nearestAirport(atof(argv[2]), atof(argv[3]));
+        if (i < 0) return 1;
+        printf("%s %s (%.4f, %.4f) %.1f nm\n", airports[i].code, airports[i].name, airports[i].lat, airports[i].lon,
+               calculateDistance(atof(argv[2]), atof(argv[3]), airports[i].lat, airports[i].lon));
+        return 0;
+    }
+    if (argc > 3 && strcmp(argv[1], "--divert") == 0) {
+        return runDiversionQuery(argc, argv);
+    }
+    if (argc > 2 && strcmp(argv[1], "--restore") == 0) {
+        return runRestore(argv[2]);
+    }
+    if (argc > 2 && strcmp(argv[1], "--fork") == 0) {
+        return runFork(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        return runBenchmarks(argc, argv);
+    }
+    if (argc > 2 && strcmp(argv[1], "--replay") == 0) {
+        return runReplay(argc, argv);
+    }
+    if (argc > 2 && strcmp(argv[1], "--subscribe") == 0) {
+        return runSubscriber(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "--check-kernels") == 0) {
+        return checkKernels();
+    }
+    if (argc > 2 && strcmp(argv[1], "--convert") == 0) {
+        return convertLog(argv[2], argc > 3 ? argv[3] : NULL);
+    }
+    if (argc > 2 && strcmp(argv[1], "--query") == 0) {
+        return queryLog(argv[2]);
+    }
+    if (argc > 2 && strcmp(argv[1], "--make-weather") == 0) {
+        return writeWeatherGrid(argv[2]);
+    }
+
+    sim_seed = (unsigned int)time(NULL);
+    current_weather = initial_weather;
     initFlight();
+    initAircraftPerformance(plane.type);
+
+    // --binary (or --binary-log) records flight_log.apm instead of flight_log.txt,
+    // --substeps N integrates each one-second tick in N physics steps,
+    // --telemetry ADDRESS streams every tick to subscribers
+    int binary_log = 0;
+    const char* telemetry_address = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--binary") == 0 || strcmp(argv[i], "--binary-log") == 0) {
+            binary_log = 1;
+        } else if (strcmp(argv[i], "--substeps") == 0 && i + 1 < argc) {
+            sim_substeps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--telemetry") == 0 && i + 1 < argc) {
+            telemetry_address = argv[++i];
+        }
+    }
+    if (sim_substeps < 1 || sim_substeps > MAX_SUBSTEPS) {
+        printf("ERROR: --substeps takes 1-1000!\n");
+        return 1;
+    }
+    FILE* log = NULL;
+    struct LogRecorder* recorder = NULL;
+    if (binary_log) {
+        recorder = recorderOpen("flight_log.apm", plane.type, dep_idx, dest_idx);
+        if (!recorder) {
+            printf("ERROR: Could not open flight_log.apm!\n");
+            return 1;
+        }
+    } else {
+        log = fopen("flight_log.txt", "w");
+        if (!log) {
+            printf("ERROR: Could not open flight_log.txt!\n");
+            return 1;
+        }
+    }
+
+    if (!initSDL(0)) {
+        if (log) fclose(log);
+        recorderClose(recorder);
+        return 1;
+    }
+
+    // Disk writes and telemetry sends happen on a background thread so a
+    // slow disk or subscriber never stalls physics or rendering; the spill
+    // list means nothing is dropped from the log
+    struct Telemetry* telemetry = telemetry_address ? telemetryOpen(telemetry_address) : NULL;
+    struct AsyncLog* async_log = NULL;
+    if (!telemetry_address || telemetry) {
+        async_log = asyncLogOpen(log, recorder, telemetry, LOG_GROW, airports[dep_idx].name, airports[dest_idx].name);
+    }
+    if (!async_log) {
+        telemetryClose(telemetry);
+        if (log) fclose(log);
+        recorderClose(recorder);
+        cleanupSDL();
+        return 1;
+    }
+
+    // Every control input is journaled with the tick it applies to, so
+    // --replay can re-fly the session exactly
+    FILE* journal = journalOpen("flight_journal.txt");
+    if (!journal) {
+        printf("ERROR: Could not open flight_journal.txt!\n");
+        asyncLogClose(async_log);
+        telemetryClose(telemetry);
+        if (log) fclose(log);
+        recorderClose(recorder);
+        cleanupSDL();
+        return 1;
+    }
+    struct FlightData journaled = plane; // controls as last journaled
 
     printf("Flight Plan: %s to %s\n", airports[dep_idx].name, airports[dest_idx].name);
     printf("Distance: %.0f nm | Fuel: %.0f gal\n", plane.distance_remaining, plane.fuel);
 
     SDL_Event event;
     Uint32 last_update = SDL_GetTicks();
+    struct FlightData previous = plane; // state at the start of the current tick
 
+    PROFILE_SET_STRIDE(1); // one tick a second: time every physics stage
     while (running) {
+        PROFILE_BEGIN(events_start);
         while (SDL_PollEvent(&event)) {
             if (event.type == SDL_QUIT) {
                 running = 0;
+            } else if (event.type == SDL_WINDOWEVENT) {
+                invalidateCockpit(0); // exposed, restored or resized: composite again
+            } else if (event.type == SDL_RENDER_TARGETS_RESET) {
+                invalidateCockpit(1);
+            } else if (event.type == SDL_TEXTINPUT) {
+                if (control_entry.control >= 0) entryText(event.text.text);
+            } else if (event.type == SDL_KEYDOWN && control_entry.control >= 0) {
+                entryKey(event.key.keysym.sym, &control_commands);
             } else if (event.type == SDL_KEYDOWN) {
+                // Controls go through the command queue and change at the
+                // next tick; T, B and F open an entry line in the cockpit
                 switch (event.key.keysym.sym) {
-                    case SDLK_t: {
-                        printf("Enter throttle (0-1): ");
-                        scanf("%f", &plane.throttle);
-                        if (plane.throttle < 0 || plane.throttle > 1) plane.throttle = 0.8;
+                    case SDLK_t:
+                        entryBegin(CONTROL_THROTTLE);
                         break;
-                    }
-                    case SDLK_b: {
-                        printf("Enter bank angle (0-30 deg): ");
-                        scanf("%f", &plane.bank_angle);
-                        if (plane.bank_angle < MIN_BANK_ANGLE || plane.bank_angle > MAX_BANK_ANGLE)
-                            plane.bank_angle = 15;
+                    case SDLK_b:
+                        entryBegin(CONTROL_BANK_ANGLE);
                         break;
-                    }
-                    case SDLK_f: {
-                        printf("Enter flaps (0-40 deg): ");
-                        scanf("%d", &plane.flaps);
-                        if (plane.flaps < 0 || plane.flaps > 40) plane.flaps = 0;
+                    case SDLK_f:
+                        entryBegin(CONTROL_FLAPS);
                         break;
-                    }
                     case SDLK_g:
-                        plane.gear = !plane.gear;
+                        commandPush(&control_commands, CONTROL_GEAR, 0);
                         break;
                     case SDLK_a:
-                        plane.autopilot = !plane.autopilot;
+                        commandPush(&control_commands, CONTROL_AUTOPILOT, 0);
                         break;
                     case SDLK_x:
-                        plane.transponder = !plane.transponder;
+                        commandPush(&control_commands, CONTROL_TRANSPONDER, 0);
+                        break;
+                    case SDLK_k: {
+                        struct Snapshot snapshot;
+                        snapshotTake(&snapshot);
+                        if (snapshotSave(&snapshot, "flight.apms")) printf("State saved to flight.apms\n");
+                        break;
+                    }
+                    case SDLK_l: {
+                        struct Snapshot snapshot;
+                        if (snapshotLoad(&snapshot, "flight.apms")) {
+                            journalRestore(journal, flight_time, &snapshot);
+                            snapshotRestore(&snapshot);
+                            journaled = plane;
+                            previous = plane;
+                            invalidateCockpit(1);
+                        }
+                        break;
+                    }
+#ifdef APM_PROFILE
+                    case SDLK_p:
+                        profileReport();
                         break;
+#endif
                     case SDLK_q:
                         running = 0;
                         break;
                 }
             }
         }
+        PROFILE_END(STAGE_EVENTS, events_start);
 
         Uint32 current_time = SDL_GetTicks();
         if (current_time - last_update >= 1000) {
-            updateFlight();
-            calculateAerodynamics();
-            calculateWindEffect();
-            updateNavigation();
-            checkFlightEnvelope();
-            updateInstruments();
-            updateWeather();
-            logData(log);
-            flight_time++;
+            previous = plane;
+            commandApply(&control_commands, &plane);
+            journalControls(journal, flight_time, &journaled);
+            stepSimulation();
+            PROFILE(STAGE_LOGGING, asyncLogPush(async_log, flight_time, 0, &plane));
+            flight_time += sim_tick; // a restored snapshot may carry a longer tick
             last_update = current_time;
         }
 
-        renderCockpit();
+        // Show the last tick's motion spread over the next second
+        float alpha = (current_time - last_update) / 1000.0f;
+        interpolateFlight(&display, &previous, &plane, alpha < 1 ? alpha : 1);
+        PROFILE(STAGE_RENDER, renderCockpit());
 
-        if (plane.fuel <= 0 || (plane.phase == 5 && plane.altitude <= 0)) {
+        if (flightComplete()) {
             running = 0;
         }
 
-        SDL_Delay(10);
+        // Nothing changes until the next simulation tick or an input event,
+        // unless the display is still moving towards the current state
+        Uint32 elapsed = SDL_GetTicks() - last_update;
+        int wait = elapsed < 1000 ? (int)(1000 - elapsed) : 0;
+        if (memcmp(&previous, &plane, sizeof(plane)) != 0 && wait > 16) wait = 16;
+        SDL_WaitEventTimeout(NULL, wait);
     }
 
     printf("Flight Ended: %s\n", plane.altitude <= 0 ? "Landed" : "Fuel Out");
-    fprintf(log, "[END] Alt: %.0f ft, Speed: %.0f kt, Fuel: %.1f gal, Dist Remain: %.0f nm\n",
-            plane.altitude, plane.speed, plane.fuel, plane.distance_remaining);
-    
-    fclose(log);
+    asyncLogPush(async_log, flight_time, 1, &plane);
+    asyncLogClose(async_log);
+    telemetryClose(telemetry);
+    journalClose(journal, flight_time);
+    if (log) fclose(log);
+    recorderClose(recorder);
     cleanupSDL();
     return 0;
 }